@@ -0,0 +1,187 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "GalilClockEstimator.h"
+
+// Arrival time error (s) above which the estimation is restarted, e.g., if the
+// controller was reset or data records were not received for a long time.
+const double RESTART_ERROR = 1.0;
+
+// Scale factor from median absolute deviation to standard deviation (normal distribution)
+const double MAD_TO_SIGMA = 1.4826;
+
+GalilClockEstimator::GalilClockEstimator(size_t windowSize, size_t fitInterval) :
+    mWindowSize(std::max(windowSize, static_cast<size_t>(MIN_POINTS))),
+    mFitInterval(fitInterval),
+    mNominalPeriod(0.001),
+    mSamples(mWindowSize), mTimes(mWindowSize), mResiduals(mWindowSize),
+    mScratch(mWindowSize), mInlier(mWindowSize)
+{
+    Reset();
+}
+
+void GalilClockEstimator::Reset(void)
+{
+    mNext = 0;
+    mNumPoints = 0;
+    mSinceFit = 0;
+    mStarted = false;
+    mLastSampleNum = 0;
+    mSample = 0;
+    mValid = false;
+    mFitSample = 0;
+    mFitTime = 0.0;
+    mPeriod = mNominalPeriod;
+    mJitter = 0.0;
+    mNumOutliers = 0;
+}
+
+void GalilClockEstimator::SetNominalPeriod(double period)
+{
+    if (period > 0.0) {
+        mNominalPeriod = period;
+        if (!mValid)
+            mPeriod = period;
+    }
+}
+
+int64_t GalilClockEstimator::Update(uint16_t sampleNum, double hostTime)
+{
+    if (mStarted) {
+        // Unsigned difference, since the sample number only increases
+        uint16_t delta = static_cast<uint16_t>(sampleNum - mLastSampleNum);
+        if (delta == 0)
+            return mSample;     // Same sample (e.g., DR faster than sample rate)
+        mSample += delta;
+        if (std::fabs(hostTime - HostTime(mSample)) > RESTART_ERROR) {
+            Reset();
+            mSample = sampleNum;
+        }
+    }
+    else
+        mSample = sampleNum;
+    mStarted = true;
+    mLastSampleNum = sampleNum;
+
+    mSamples[mNext] = mSample;
+    mTimes[mNext] = hostTime;
+    mNext = (mNext+1)%mWindowSize;
+    if (mNumPoints < mWindowSize)
+        mNumPoints++;
+    mSinceFit++;
+
+    if ((mNumPoints >= MIN_POINTS) && (!mValid || (mSinceFit >= mFitInterval)))
+        Fit();
+    if (!mValid) {
+        // Until the first fit, use the nominal period and the last arrival time
+        mFitSample = mSample;
+        mFitTime = hostTime;
+    }
+    return mSample;
+}
+
+double GalilClockEstimator::HostTime(int64_t sample) const
+{
+    return mFitTime + static_cast<double>(sample - mFitSample)*mPeriod;
+}
+
+double GalilClockEstimator::Offset(void) const
+{
+    return HostTime(mSample) - static_cast<double>(mSample)*mNominalPeriod;
+}
+
+bool GalilClockEstimator::LineFit(const std::vector<bool> *mask, double &intercept, double &slope) const
+{
+    // Relative to the last sample, to preserve precision
+    double n = 0.0, sx = 0.0, sy = 0.0;
+    for (size_t i = 0; i < mNumPoints; i++) {
+        if (mask && !(*mask)[i])
+            continue;
+        n += 1.0;
+        sx += static_cast<double>(mSamples[i] - mSample);
+        sy += mTimes[i];
+    }
+    if (n < 2.0)
+        return false;
+    const double mx = sx/n;
+    const double my = sy/n;
+    double sxx = 0.0, sxy = 0.0;
+    for (size_t i = 0; i < mNumPoints; i++) {
+        if (mask && !(*mask)[i])
+            continue;
+        double dx = static_cast<double>(mSamples[i] - mSample) - mx;
+        sxx += dx*dx;
+        sxy += dx*(mTimes[i] - my);
+    }
+    if (sxx <= 0.0)
+        return false;
+    slope = sxy/sxx;
+    intercept = my - slope*mx;     // Time at last sample
+    return true;
+}
+
+void GalilClockEstimator::Fit(void)
+{
+    mSinceFit = 0;
+    double intercept, slope;
+    if (!LineFit(0, intercept, slope))
+        return;
+
+    // Reject points far from the initial fit (median absolute deviation)
+    size_t i;
+    for (i = 0; i < mNumPoints; i++)
+        mResiduals[i] = mTimes[i] - (intercept + static_cast<double>(mSamples[i] - mSample)*slope);
+    std::copy(mResiduals.begin(), mResiduals.begin()+mNumPoints, mScratch.begin());
+    std::nth_element(mScratch.begin(), mScratch.begin()+mNumPoints/2, mScratch.begin()+mNumPoints);
+    const double median = mScratch[mNumPoints/2];
+    for (i = 0; i < mNumPoints; i++)
+        mScratch[i] = std::fabs(mResiduals[i] - median);
+    std::nth_element(mScratch.begin(), mScratch.begin()+mNumPoints/2, mScratch.begin()+mNumPoints);
+    const double threshold = std::max(3.0*MAD_TO_SIGMA*mScratch[mNumPoints/2], 1.0e-6);
+    size_t numInliers = 0;
+    for (i = 0; i < mNumPoints; i++) {
+        mInlier[i] = (std::fabs(mResiduals[i] - median) <= threshold);
+        if (mInlier[i])
+            numInliers++;
+    }
+    if ((numInliers < MIN_POINTS/2) || !LineFit(&mInlier, intercept, slope))
+        return;
+    // Reject fits that are not plausible (e.g., sample numbers not consistent with arrival times)
+    if ((slope < 0.9*mNominalPeriod) || (slope > 1.1*mNominalPeriod))
+        return;
+
+    // Jitter and earliest arrival, with respect to the final fit
+    double sumSq = 0.0;
+    double minResidual = 0.0;
+    bool first = true;
+    for (i = 0; i < mNumPoints; i++) {
+        if (!mInlier[i])
+            continue;
+        double r = mTimes[i] - (intercept + static_cast<double>(mSamples[i] - mSample)*slope);
+        sumSq += r*r;
+        if (first || (r < minResidual))
+            minResidual = r;
+        first = false;
+    }
+    mFitSample = mSample;
+    mFitTime = intercept + minResidual;
+    mPeriod = slope;
+    mJitter = std::sqrt(sumSq/numInliers);
+    mNumOutliers = mNumPoints - numInliers;
+    mValid = true;
+}
@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Estimator for the mapping from the controller sample number (16-bit counter in
+  the data record) to host time. The counter is unwrapped to 64 bits and a line
+  (host time vs. sample number) is fit to the host arrival times of the most recent
+  data records. The fit is robust: arrival times far from an initial least squares
+  fit (more than 3 times the scaled median absolute deviation) are rejected and the
+  line is fit again to the remaining points. Since arrival times are the sampling
+  times plus a (nonnegative) transport delay, the line is then shifted down to the
+  earliest inlier arrival, so that it estimates the sampling time plus the minimum
+  transport delay.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilClockEstimator_h
+#define _GalilClockEstimator_h
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+class GalilClockEstimator
+{
+public:
+
+    //    windowSize   number of data records used for the fit
+    //    fitInterval  number of data records between fits
+    GalilClockEstimator(size_t windowSize = 512, size_t fitInterval = 32);
+    ~GalilClockEstimator() {}
+
+    // Restart the estimation (e.g., after reconnecting, since the controller may have been reset)
+    void Reset(void);
+    // Nominal sample period (s), e.g., from TM; used until the first fit
+    void SetNominalPeriod(double period);
+
+    // Add a data record, given its 16-bit sample number and host arrival time (s).
+    // Returns the unwrapped sample number.
+    int64_t Update(uint16_t sampleNum, double hostTime);
+
+    // Whether there are enough data records for an estimate
+    bool IsValid(void) const { return mValid; }
+    // Estimated host time at which the specified (unwrapped) sample was taken
+    double HostTime(int64_t sample) const;
+    // Last unwrapped sample number
+    int64_t Sample(void) const { return mSample; }
+
+    // Estimated sample period (s)
+    double Period(void) const { return mPeriod; }
+    // Relative drift of the controller clock with respect to the host clock (i.e., estimated
+    // period divided by nominal period, minus 1)
+    double Drift(void) const { return mPeriod/mNominalPeriod - 1.0; }
+    // Host time of the last sample minus controller time (sample number times nominal period)
+    double Offset(void) const;
+    // RMS residual of the inliers (s)
+    double Jitter(void) const { return mJitter; }
+    // Number of points rejected in the last fit
+    size_t NumOutliers(void) const { return mNumOutliers; }
+
+protected:
+
+    enum { MIN_POINTS = 32 };
+
+    size_t   mWindowSize;
+    size_t   mFitInterval;
+    double   mNominalPeriod;
+
+    // Window of (unwrapped sample, arrival time); all buffers are allocated in the constructor
+    std::vector<int64_t> mSamples;
+    std::vector<double>  mTimes;
+    std::vector<double>  mResiduals;
+    std::vector<double>  mScratch;
+    std::vector<bool>    mInlier;
+    size_t   mNext;
+    size_t   mNumPoints;
+    size_t   mSinceFit;
+
+    bool     mStarted;
+    uint16_t mLastSampleNum;
+    int64_t  mSample;
+
+    // Fit: host time = mFitTime + (sample - mFitSample)*mPeriod
+    bool     mValid;
+    int64_t  mFitSample;
+    double   mFitTime;
+    double   mPeriod;
+    double   mJitter;
+    size_t   mNumOutliers;
+
+    void Fit(void);
+    // Least squares fit of points with mask[i] (or all points if mask is 0); returns false if
+    // the fit is not possible
+    bool LineFit(const std::vector<bool> *mask, double &intercept, double &slope) const;
+};
+
+#endif // _GalilClockEstimator_h
@@ -0,0 +1,276 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <cisstCommon/cmnPortability.h>
+
+#if (CISST_OS != CISST_WINDOWS)
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#include "GalilCommandPipeline.h"
+
+const unsigned short GALIL_TCP_PORT = 23;
+
+GalilCommandPipeline::GalilCommandPipeline() :
+    mSocket(-1), mDepth(1), mTimeoutMs(1000), mNumErrors(0), mNumSent(0), mRecvLen(0), mRecvPos(0)
+{
+}
+
+GalilCommandPipeline::~GalilCommandPipeline()
+{
+    Close();
+}
+
+bool GalilCommandPipeline::Open(const char *ipAddress, unsigned int depth, int timeoutMs)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    Close();
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(GALIL_TCP_PORT);
+    if (inet_pton(AF_INET, ipAddress, &addr.sin_addr) != 1)
+        return false;
+    mSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (mSocket < 0)
+        return false;
+    if (connect(mSocket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        Close();
+        return false;
+    }
+    // Commands are small and must not wait for previous acknowledgements
+    int flag = 1;
+    setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    mDepth = (depth > 0) ? depth : 1;
+    mTimeoutMs = timeoutMs;
+    mRecvLen = 0;
+    mRecvPos = 0;
+    // Set the MSB of unsolicited characters (e.g., from MG in a DMC program), so that
+    // they can be told apart from acknowledgements
+    if (!WriteCommand("CW 1") || (ReadAck() != ':')) {
+        Close();
+        return false;
+    }
+    return true;
+#else
+    (void)ipAddress; (void)depth; (void)timeoutMs;
+    return false;
+#endif
+}
+
+void GalilCommandPipeline::Close(void)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    if (mSocket >= 0) {
+        close(mSocket);
+        mSocket = -1;
+    }
+#endif
+}
+
+bool GalilCommandPipeline::WriteCommand(const char *cmd)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    // Galil commands are terminated by carriage return
+    char buf[256];
+    size_t len = strlen(cmd);
+    if (len+1 >= sizeof(buf))
+        return false;
+    memcpy(buf, cmd, len);
+    buf[len++] = '\r';
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(mSocket, buf+sent, len-sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+#else
+    (void)cmd;
+    return false;
+#endif
+}
+
+char GalilCommandPipeline::ReadChar(void)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    if (mRecvPos >= mRecvLen) {
+        struct pollfd pfd;
+        pfd.fd = mSocket;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, mTimeoutMs) <= 0)
+            return 0;
+        ssize_t n = recv(mSocket, mRecvBuffer, sizeof(mRecvBuffer), 0);
+        if (n <= 0)
+            return 0;
+        mRecvLen = static_cast<size_t>(n);
+        mRecvPos = 0;
+    }
+    return mRecvBuffer[mRecvPos++];
+#else
+    return 0;
+#endif
+}
+
+char GalilCommandPipeline::ReadAck(void)
+{
+    for (;;) {
+        char c = ReadChar();
+        if ((c == ':') || (c == '?') || (c == 0))
+            return c;
+        // Ignore anything else (e.g., whitespace and unsolicited characters)
+    }
+}
+
+void GalilCommandPipeline::AddError(size_t index)
+{
+    if (mNumErrors < MAX_ERRORS) {
+        Error &err = mErrors[mNumErrors++];
+        err.index = index;
+        err.code = -1;
+        err.message[0] = 0;
+    }
+}
+
+size_t GalilCommandPipeline::NumCommands(const char *cmd)
+{
+    size_t num = 1;
+    bool quoted = false;
+    for (; *cmd; cmd++) {
+        if (*cmd == '"')
+            quoted = !quoted;
+        else if ((*cmd == ';') && !quoted)
+            num++;
+    }
+    return num;
+}
+
+bool GalilCommandPipeline::QueryErrorCode(Error *err, int &numFailed)
+{
+    // TC1 returns the code and message of the last error, e.g., " 1 Unrecognized command\r\n:".
+    // The acknowledgements of the commands still in flight arrive first, without any text.
+    if (!WriteCommand("TC1"))
+        return false;
+    char buf[sizeof(err->message)+8];
+    size_t len;
+    bool text;
+    char c;
+    do {
+        len = 0;
+        text = false;
+        for (;;) {
+            c = ReadChar();
+            if (c == 0)
+                return false;
+            if ((c == ':') || (c == '?'))
+                break;
+            if ((c == '\r') || (c == '\n') || (static_cast<unsigned char>(c) & 0x80))
+                continue;    // Line end or unsolicited character
+            if (c != ' ')
+                text = true;
+            if (len < sizeof(buf)-1)
+                buf[len++] = c;
+        }
+        // Failed command still in flight, in which case err is no longer the last error
+        if (!text && (c == '?')) {
+            numFailed++;
+            err = 0;
+        }
+    } while (!text);
+    if (!err || (c == '?'))
+        return true;     // Error code of first failure remains unknown
+    buf[len] = 0;
+    char *end;
+    long code = strtol(buf, &end, 10);
+    if (end != buf) {
+        err->code = static_cast<int>(code);
+        while (*end == ' ')
+            end++;
+        strncpy(err->message, end, sizeof(err->message)-1);
+        err->message[sizeof(err->message)-1] = 0;
+    }
+    return true;
+}
+
+int GalilCommandPipeline::SendBatch(const char * const *cmds, size_t num)
+{
+    mNumErrors = 0;
+    mNumSent = 0;
+    if (!IsOpen())
+        return -1;
+
+    // Each command in a line (separated by ';') is acknowledged, so the window counts
+    // commands rather than lines. A line with more commands than the depth is only sent
+    // when nothing else is in flight.
+    size_t sent = 0;
+    size_t acked = 0;
+    size_t inFlight = 0;
+    size_t ackLeft = (num > 0) ? NumCommands(cmds[0]) : 0;   // For line "acked"
+    while (acked < num) {
+        // Fill the window
+        while (sent < num) {
+            size_t n = NumCommands(cmds[sent]);
+            if ((inFlight > 0) && (inFlight + n > mDepth))
+                break;
+            if (!WriteCommand(cmds[sent])) {
+                Close();
+                return -1;
+            }
+            inFlight += n;
+            sent++;
+        }
+        char ack = ReadAck();
+        if (ack == 0) {
+            Close();
+            return -1;
+        }
+        inFlight--;
+        if (ack == '?')
+            break;
+        if (--ackLeft == 0) {
+            acked++;
+            ackLeft = (acked < num) ? NumCommands(cmds[acked]) : 0;
+        }
+    }
+    mNumSent = sent;
+    if (acked == num)
+        return 0;
+
+    // Line "acked" failed: the rest of the batch is not sent. The controller may or may not
+    // acknowledge the commands that follow the failed command in the same line, so the
+    // remaining acknowledgements cannot be counted; TC1 is sent instead and everything up
+    // to its reply is drained.
+    int numFailed = 1;
+    AddError(acked);
+    if (!QueryErrorCode(&mErrors[0], numFailed)) {
+        Close();
+        return -1;
+    }
+    return numFailed;
+}
@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Raw TCP command channel to a Galil controller (port 23) that keeps up to N
+  commands in flight, rather than waiting for each acknowledgement (':' or '?')
+  before sending the next command, as done by gclib GCmd. A batch entry can be
+  a line with several commands separated by ';' (e.g., "KP 6,6;KD 64,64"),
+  each of which is acknowledged. Acknowledgements are matched to commands in
+  order; when a command fails, the channel stops sending (the rest of the batch
+  is not sent), drains the commands still in flight and uses TC1 to get the
+  error code and message for the failed command.
+  CW 1 is sent when the channel is opened, so that the controller sets the MSB of
+  unsolicited characters, which are then not mistaken for acknowledgements.
+
+  Only commands whose sole response is the acknowledgement (e.g., SP, AC, PA, ST)
+  should be sent through this channel; queries (e.g., "LD ?") must use gclib.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilCommandPipeline_h
+#define _GalilCommandPipeline_h
+
+#include <cstddef>
+
+class GalilCommandPipeline
+{
+public:
+
+    enum { MAX_ERRORS = 8 };
+
+    struct Error {
+        size_t index;           // Index of failed command in batch
+        int    code;            // Galil error code (from TC1), -1 if not known
+        char   message[80];     // Galil error message (from TC1)
+    };
+
+    GalilCommandPipeline();
+    ~GalilCommandPipeline();
+
+    // Open TCP connection to ipAddress (dotted decimal) on port 23
+    //    depth      maximum number of commands in flight
+    //    timeoutMs  timeout for each acknowledgement
+    bool Open(const char *ipAddress, unsigned int depth, int timeoutMs);
+    void Close(void);
+    bool IsOpen(void) const { return (mSocket >= 0); }
+    unsigned int Depth(void) const { return mDepth; }
+
+    // Send a batch of command lines. Returns the number of commands that failed (the
+    // first one is in GetError(0), with its code if it was the last one to fail), or
+    // -1 on a communication error (in which case the channel is closed and it is not
+    // known which commands were executed). After a failure, only the first NumSent
+    // lines were sent.
+    int SendBatch(const char * const *cmds, size_t num);
+
+    size_t NumSent(void) const { return mNumSent; }
+    size_t NumErrors(void) const { return mNumErrors; }
+    const Error &GetError(size_t i) const { return mErrors[i]; }
+
+protected:
+
+    int           mSocket;
+    unsigned int  mDepth;
+    int           mTimeoutMs;
+    Error         mErrors[MAX_ERRORS];
+    size_t        mNumErrors;
+    size_t        mNumSent;
+
+    // Received data not yet consumed
+    char          mRecvBuffer[256];
+    size_t        mRecvLen;
+    size_t        mRecvPos;
+
+    bool WriteCommand(const char *cmd);
+    // Read next character from the controller (0 on error or timeout)
+    char ReadChar(void);
+    // Read next acknowledgement: returns ':' or '?', or 0 on error or timeout
+    // (unsolicited characters, which have the MSB set, are skipped)
+    char ReadAck(void);
+    // Record error for specified command index
+    void AddError(size_t index);
+    // Number of commands in a line (separated by ';')
+    static size_t NumCommands(const char *cmd);
+    // Issue TC1 and store result in err, after draining the commands still in flight
+    // (failures among them are added to numFailed, and err is then not updated)
+    bool QueryErrorCode(Error *err, int &numFailed);
+};
+
+#endif // _GalilCommandPipeline_h
@@ -0,0 +1,231 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+
+#include <cisstCommon/cmnPortability.h>
+
+#if (CISST_OS != CISST_WINDOWS)
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "GalilDataRecordSocket.h"
+
+const unsigned short GALIL_UDP_PORT = 23;
+// Smallest data record (DMC-1802, 40 bytes plus axis data); the responses to the
+// commands sent on this socket (WH and DR) are much shorter
+const size_t MIN_RECORD_SIZE = 40;
+
+#if (CISST_OS != CISST_WINDOWS)
+static double TimespecToSeconds(const struct timespec &ts)
+{
+    return ts.tv_sec + ts.tv_nsec*1.0e-9;
+}
+#endif
+
+GalilDataRecordSocket::GalilDataRecordSocket() :
+    mSocket(-1), mTimeoutMs(1000), mKernelTimestamps(false), mHandle(0)
+{
+}
+
+GalilDataRecordSocket::~GalilDataRecordSocket()
+{
+    Close();
+}
+
+bool GalilDataRecordSocket::Open(const char *ipAddress, int timeoutMs)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    Close();
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(GALIL_UDP_PORT);
+    if (inet_pton(AF_INET, ipAddress, &addr.sin_addr) != 1)
+        return false;
+    mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (mSocket < 0)
+        return false;
+    // Connected, so that only packets from the controller are received
+    if (connect(mSocket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        Close();
+        return false;
+    }
+    int flag = 1;
+#if (CISST_OS == CISST_LINUX)
+    mKernelTimestamps = (setsockopt(mSocket, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag)) == 0);
+#else
+    mKernelTimestamps = (setsockopt(mSocket, SOL_SOCKET, SO_TIMESTAMP, &flag, sizeof(flag)) == 0);
+#endif
+    mTimeoutMs = timeoutMs;
+    // The first packet establishes the handle; WH returns its name, e.g., "IHC"
+    char response[64];
+    if (!SendCommand("WH", response, sizeof(response))) {
+        Close();
+        return false;
+    }
+    const char *ih = strstr(response, "IH");
+    if (!ih || (ih[2] < 'A') || (ih[2] > 'P')) {
+        Close();
+        return false;
+    }
+    mHandle = ih[2];
+    return true;
+#else
+    (void)ipAddress; (void)timeoutMs;
+    return false;
+#endif
+}
+
+void GalilDataRecordSocket::Close(void)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    if (mSocket >= 0) {
+        if (mHandle) {
+            // Stop the DR and release the handle (no response expected for the latter)
+            char cmd[16];
+            SetRate(0);
+            sprintf(cmd, "IH%c=>-3\r", mHandle);
+            send(mSocket, cmd, strlen(cmd), 0);
+        }
+        close(mSocket);
+        mSocket = -1;
+    }
+#endif
+    mHandle = 0;
+    mKernelTimestamps = false;
+}
+
+bool GalilDataRecordSocket::SendCommand(const char *cmd, char *response, size_t size)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), "%s\r", cmd);
+    if ((len <= 0) || (static_cast<size_t>(len) >= sizeof(buf)))
+        return false;
+    if (send(mSocket, buf, len, 0) != len)
+        return false;
+    // Response is a single packet terminated by ':' (or '?' on error). Data records are
+    // recognized by their size, since they do not all have a header (e.g., DMC-1806).
+    for (int tries = 0; tries < 100; tries++) {
+        struct pollfd pfd;
+        pfd.fd = mSocket;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, mTimeoutMs) <= 0)
+            return false;
+        unsigned char packet[512];
+        ssize_t n = recv(mSocket, packet, sizeof(packet), 0);
+        if (n <= 0)
+            return false;
+        if (static_cast<size_t>(n) >= MIN_RECORD_SIZE)
+            continue;
+        size_t end = static_cast<size_t>(n);
+        while ((end > 0) && ((packet[end-1] == '\r') || (packet[end-1] == '\n')))
+            end--;
+        if ((end == 0) || (packet[end-1] == '?'))
+            return false;
+        if (packet[end-1] != ':')
+            continue;
+        if (response) {
+            size_t copy = (end-1 < size-1) ? end-1 : size-1;
+            memcpy(response, packet, copy);
+            response[copy] = 0;
+        }
+        return true;
+    }
+    return false;
+#else
+    (void)cmd; (void)response; (void)size;
+    return false;
+#endif
+}
+
+bool GalilDataRecordSocket::SetRate(unsigned int samples)
+{
+    if (!IsOpen() || !mHandle)
+        return false;
+    char cmd[32];
+    sprintf(cmd, "DR %u,%d", samples, mHandle - 'A');
+    return SendCommand(cmd, 0, 0);
+}
+
+size_t GalilDataRecordSocket::Receive(void *buffer, size_t size, int timeoutMs,
+                                      double &kernelTime, double &userTime)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    struct pollfd pfd;
+    pfd.fd = mSocket;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+        return 0;
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    char control[256];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(mSocket, &msg, 0);
+    if (n <= 0)
+        return 0;
+
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    userTime = TimespecToSeconds(mono);
+    kernelTime = userTime;
+    if (mKernelTimestamps) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+            double stamp = -1.0;
+#if (CISST_OS == CISST_LINUX)
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                stamp = TimespecToSeconds(ts);
+            }
+#else
+            if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+                struct timeval tv;
+                memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+                stamp = tv.tv_sec + tv.tv_usec*1.0e-6;
+            }
+#endif
+            if (stamp > 0.0) {
+                // Kernel timestamp is realtime clock; convert using the current offset
+                clock_gettime(CLOCK_REALTIME, &real);
+                double delay = TimespecToSeconds(real) - stamp;
+                if (delay >= 0.0)
+                    kernelTime = userTime - delay;
+            }
+        }
+    }
+    return static_cast<size_t>(n);
+#else
+    (void)buffer; (void)size; (void)timeoutMs;
+    (void)kernelTime; (void)userTime;
+    return 0;
+#endif
+}
@@ -0,0 +1,66 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  UDP socket for receiving data records (DR) from a Galil controller, used instead
+  of gclib GRecord so that the receive time can be taken by the kernel (SO_TIMESTAMPNS
+  on Linux, SO_TIMESTAMP on other Unix systems), rather than when the thread is
+  scheduled. The socket establishes a UDP handle on the controller (port 23), gets
+  its name with WH and sets the DR rate for that handle (DR n,h).
+
+  Times are host times in seconds (CLOCK_MONOTONIC); the kernel receive time is
+  converted from the realtime clock used by the kernel timestamps.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilDataRecordSocket_h
+#define _GalilDataRecordSocket_h
+
+#include <cstddef>
+
+class GalilDataRecordSocket
+{
+public:
+
+    GalilDataRecordSocket();
+    ~GalilDataRecordSocket();
+
+    // Open UDP connection to ipAddress (dotted decimal) on port 23 and get the handle
+    bool Open(const char *ipAddress, int timeoutMs);
+    void Close(void);
+    bool IsOpen(void) const { return (mSocket >= 0); }
+    // Whether the kernel provides receive timestamps
+    bool HasKernelTimestamps(void) const { return mKernelTimestamps; }
+    // Handle name on controller (e.g., 'C' for IHC)
+    char Handle(void) const { return mHandle; }
+
+    // Set DR period in samples (0 to stop)
+    bool SetRate(unsigned int samples);
+
+    // Receive a data record (at most size bytes) within timeoutMs. Returns the number of
+    // bytes received (0 on timeout or error). kernelTime is the kernel receive time (or
+    // userTime if not available) and userTime the time when the record was read.
+    size_t Receive(void *buffer, size_t size, int timeoutMs, double &kernelTime, double &userTime);
+
+protected:
+
+    int    mSocket;
+    int    mTimeoutMs;
+    bool   mKernelTimestamps;
+    char   mHandle;
+
+    // Send command and wait for response (data records received in the meantime are
+    // discarded). Returns false on error or timeout.
+    bool SendCommand(const char *cmd, char *response, size_t size);
+};
+
+#endif // _GalilDataRecordSocket_h
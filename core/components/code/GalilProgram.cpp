@@ -0,0 +1,206 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstring>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include "GalilProgram.h"
+
+// Maximum number of characters in a label (not including #)
+const size_t MAX_LABEL_LENGTH = 7;
+
+// Characters around which whitespace is not needed
+static bool IsDelimiter(char c)
+{
+    return (c == 0) || (strchr(",;=()+-*/<>&|:[]{}", c) != 0);
+}
+
+GalilProgram::GalilProgram() :
+    mNumLines(0), mOriginalSize(0)
+{
+}
+
+bool GalilProgram::Load(const std::string &fileName)
+{
+    mProgram.clear();
+    mNumLines = 0;
+    mOriginalSize = 0;
+    mLabels.clear();
+    mErrors.clear();
+    return LoadFile(fileName, 0);
+}
+
+void GalilProgram::Append(const std::string &text)
+{
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::string processed = ProcessLine(line);
+        if (!processed.empty())
+            AddLine(processed);
+    }
+}
+
+bool GalilProgram::LoadFile(const std::string &fileName, unsigned int depth)
+{
+    if (depth > MAX_INCLUDE_DEPTH) {
+        mErrors.push_back("too many levels of #include in " + fileName);
+        return false;
+    }
+    std::ifstream file(fileName.c_str());
+    if (!file.is_open()) {
+        mErrors.push_back("could not open " + fileName);
+        return false;
+    }
+    // Included files are relative to the directory of the including file
+    std::string dir;
+    size_t sep = fileName.find_last_of("/\\");
+    if (sep != std::string::npos)
+        dir = fileName.substr(0, sep+1);
+
+    bool ok = true;
+    std::string line;
+    while (std::getline(file, line)) {
+        mOriginalSize += line.size() + 1;
+        size_t first = line.find_first_not_of(" \t\r");
+        if ((first != std::string::npos) && (line.compare(first, 8, "#include") == 0)) {
+            size_t open = line.find('"', first+8);
+            size_t close = (open == std::string::npos) ? open : line.find('"', open+1);
+            if (close == std::string::npos) {
+                mErrors.push_back("invalid #include in " + fileName + ": " + line);
+                ok = false;
+                continue;
+            }
+            std::string includeName = line.substr(open+1, close-open-1);
+            if ((includeName[0] != '/') && (includeName[0] != '\\'))
+                includeName = dir + includeName;
+            if (!LoadFile(includeName, depth+1))
+                ok = false;
+            continue;
+        }
+        std::string processed = ProcessLine(line);
+        if (!processed.empty())
+            AddLine(processed);
+    }
+    return ok;
+}
+
+std::string GalilProgram::ProcessLine(const std::string &line)
+{
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return std::string();
+    // REM lines are comments
+    if ((line.compare(first, 3, "REM") == 0) &&
+        ((first+3 == line.size()) || isspace(static_cast<unsigned char>(line[first+3]))))
+        return std::string();
+
+    std::string result;
+    bool inString = false;
+    for (size_t i = first; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '"') {
+            inString = !inString;
+            result.append(1, c);
+        }
+        else if (inString) {
+            result.append(1, c);
+        }
+        else if (c == '\'') {
+            break;     // Comment until end of line
+        }
+        else if ((c == ' ') || (c == '\t') || (c == '\r')) {
+            // Keep a single space, only where needed (i.e., not next to a delimiter)
+            size_t next = line.find_first_not_of(" \t\r", i);
+            char nextChar = (next == std::string::npos) ? 0 : line[next];
+            if (!result.empty() && !IsDelimiter(result[result.size()-1]) && !IsDelimiter(nextChar)
+                && (nextChar != '\''))
+                result.append(1, ' ');
+            if (next == std::string::npos)
+                break;
+            i = next-1;
+        }
+        else {
+            result.append(1, c);
+        }
+    }
+    // Remove trailing semicolons (and whitespace)
+    size_t last = result.find_last_not_of("; ");
+    if (last == std::string::npos)
+        return std::string();
+    result.erase(last+1);
+    return result;
+}
+
+void GalilProgram::AddLine(const std::string &line)
+{
+    if (line[0] == '#') {
+        size_t len = 1;
+        while ((len < line.size()) && (isalnum(static_cast<unsigned char>(line[len])) || (line[len] == '_')))
+            len++;
+        std::string label = line.substr(0, len);
+        for (size_t i = 0; i < mLabels.size(); i++) {
+            if (mLabels[i] == label) {
+                mErrors.push_back("duplicate label " + label);
+                break;
+            }
+        }
+        mLabels.push_back(label);
+    }
+    mProgram.append(line);
+    mProgram.append(1, '\n');
+    mNumLines++;
+}
+
+bool GalilProgram::Check(size_t maxLineLength, size_t maxLines, size_t maxLabels)
+{
+    bool ok = mErrors.empty();
+    std::ostringstream err;
+    size_t lineNum = 0;
+    size_t start = 0;
+    while (start < mProgram.size()) {
+        size_t end = mProgram.find('\n', start);
+        lineNum++;
+        if (end - start > maxLineLength) {
+            err.str("");
+            err << "line " << lineNum << " is too long (" << (end - start) << " > "
+                << maxLineLength << "): " << mProgram.substr(start, end - start);
+            mErrors.push_back(err.str());
+            ok = false;
+        }
+        start = end+1;
+    }
+    if (mNumLines > maxLines) {
+        err.str("");
+        err << "too many lines (" << mNumLines << " > " << maxLines << ")";
+        mErrors.push_back(err.str());
+        ok = false;
+    }
+    if (mLabels.size() > maxLabels) {
+        err.str("");
+        err << "too many labels (" << mLabels.size() << " > " << maxLabels << ")";
+        mErrors.push_back(err.str());
+        ok = false;
+    }
+    for (size_t i = 0; i < mLabels.size(); i++) {
+        if (mLabels[i].size()-1 > MAX_LABEL_LENGTH) {
+            mErrors.push_back("label " + mLabels[i] + " is too long");
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,71 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Preprocessor for DMC programs, used before downloading a program to the
+  controller. It removes comments (REM lines and ' comments), blank lines and
+  unnecessary whitespace, and replaces lines of the form
+
+      #include "file.dmc"
+
+  by the (preprocessed) contents of the file, relative to the including file.
+  The result can then be checked against the limits of the controller model
+  (line length, number of lines and labels).
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilProgram_h
+#define _GalilProgram_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class GalilProgram
+{
+public:
+
+    GalilProgram();
+    ~GalilProgram() {}
+
+    // Load and preprocess the program (returns false on error, see GetErrors)
+    bool Load(const std::string &fileName);
+    // Append a fragment (e.g., generated code) to the preprocessed program
+    void Append(const std::string &text);
+    // Check program against controller limits (returns false on error, see GetErrors)
+    bool Check(size_t maxLineLength, size_t maxLines, size_t maxLabels);
+
+    // Preprocessed program (lines terminated by newline)
+    const std::string &GetProgram(void) const { return mProgram; }
+    size_t NumLines(void) const { return mNumLines; }
+    size_t NumLabels(void) const { return mLabels.size(); }
+    // Size of original files, including the included files (bytes)
+    size_t OriginalSize(void) const { return mOriginalSize; }
+    const std::vector<std::string> &GetErrors(void) const { return mErrors; }
+
+protected:
+
+    enum { MAX_INCLUDE_DEPTH = 8 };
+
+    std::string              mProgram;
+    size_t                   mNumLines;
+    size_t                   mOriginalSize;
+    std::vector<std::string> mLabels;
+    std::vector<std::string> mErrors;
+
+    bool LoadFile(const std::string &fileName, unsigned int depth);
+    // Preprocess one line (returns empty string if nothing is left)
+    static std::string ProcessLine(const std::string &line);
+    void AddLine(const std::string &line);
+};
+
+#endif // _GalilProgram_h
@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstring>
+#include <cerrno>
+
+#include <cisstCommon/cmnPortability.h>
+
+#if (CISST_OS != CISST_WINDOWS)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "GalilTelemetryWriter.h"
+
+// The layout is shared with other processes (and languages), so it must not depend on
+// the compiler (see GalilTelemetry.h)
+static_assert(sizeof(GalilTelemetrySample) == 352, "GalilTelemetrySample layout changed");
+static_assert(sizeof(GalilTelemetryHeader) == 456, "GalilTelemetryHeader layout changed");
+
+GalilTelemetryWriter::GalilTelemetryWriter() :
+    mHeader(0), mHistory(0), mSize(0)
+{
+}
+
+GalilTelemetryWriter::~GalilTelemetryWriter()
+{
+    Close();
+}
+
+bool GalilTelemetryWriter::Open(const std::string &name, const std::string &componentName,
+                                unsigned int numAxes, unsigned int historyLength, std::string &error)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    Close();
+    if (numAxes > GALIL_TELEMETRY_MAX_AXES) {
+        error = "too many axes for telemetry";
+        return false;
+    }
+    if (historyLength == 0)
+        historyLength = 1;
+    // Replace existing segment (e.g., left by a previous run), so that readers of that
+    // segment do not see a change of layout
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        error = "could not create shared memory " + name + ": " + strerror(errno);
+        return false;
+    }
+    size_t size = sizeof(GalilTelemetryHeader) + historyLength*sizeof(GalilTelemetrySample);
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        error = "could not set size of shared memory " + name + ": " + strerror(errno);
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void *addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        error = "could not map shared memory " + name + ": " + strerror(errno);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    // Touch all pages now (prefault), rather than in Publish
+    memset(addr, 0, size);
+    mName = name;
+    mSize = size;
+    mHeader = static_cast<GalilTelemetryHeader *>(addr);
+    mHistory = reinterpret_cast<GalilTelemetrySample *>(static_cast<char *>(addr) + sizeof(GalilTelemetryHeader));
+    mHeader->version = GALIL_TELEMETRY_VERSION;
+    mHeader->header_size = sizeof(GalilTelemetryHeader);
+    mHeader->sample_size = sizeof(GalilTelemetrySample);
+    mHeader->num_axes = numAxes;
+    mHeader->history_length = historyLength;
+    mHeader->pid = static_cast<uint32_t>(getpid());
+    strncpy(mHeader->name, componentName.c_str(), GALIL_TELEMETRY_NAME_SIZE-1);
+    // Readers check the magic number last
+    __atomic_store_n(&mHeader->magic, GALIL_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+    return true;
+#else
+    error = "telemetry shared memory not supported on this platform";
+    return false;
+#endif
+}
+
+void GalilTelemetryWriter::Close(void)
+{
+#if (CISST_OS != CISST_WINDOWS)
+    if (mHeader) {
+        munmap(mHeader, mSize);
+        shm_unlink(mName.c_str());
+    }
+#endif
+    mHeader = 0;
+    mHistory = 0;
+    mSize = 0;
+}
+
+void GalilTelemetryWriter::WriteSample(GalilTelemetrySample *dest, const GalilTelemetrySample &src, uint64_t index)
+{
+    // Seqlock: odd while writing
+    uint32_t seq = dest->seq;
+    __atomic_store_n(&dest->seq, seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(reinterpret_cast<char *>(dest) + sizeof(dest->seq), reinterpret_cast<const char *>(&src) + sizeof(src.seq),
+           sizeof(GalilTelemetrySample) - sizeof(src.seq));
+    dest->index = index;
+    __atomic_store_n(&dest->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+void GalilTelemetryWriter::Publish(const GalilTelemetrySample &sample)
+{
+    if (!mHeader)
+        return;
+    const uint64_t head = mHeader->head;
+    WriteSample(&mHeader->latest, sample, head);
+    WriteSample(&mHistory[head % mHeader->history_length], sample, head);
+    __atomic_store_n(&mHeader->head, head+1, __ATOMIC_RELEASE);
+}
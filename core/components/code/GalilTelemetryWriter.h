@@ -0,0 +1,56 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Writer for the telemetry shared-memory segment (see GalilTelemetry.h for the
+  layout and the reader). The segment is created and prefaulted in Open, so that
+  Publish only copies the sample (no system calls or memory allocation).
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilTelemetryWriter_h
+#define _GalilTelemetryWriter_h
+
+#include <cstddef>
+#include <string>
+
+#include <sawGalilController/GalilTelemetry.h>
+
+class GalilTelemetryWriter
+{
+public:
+
+    GalilTelemetryWriter();
+    ~GalilTelemetryWriter();
+
+    // Create the segment (shm_open name, e.g., "/galil_telemetry"), replacing any existing
+    // one. Returns false (with error message) on failure.
+    bool Open(const std::string &name, const std::string &componentName, unsigned int numAxes,
+              unsigned int historyLength, std::string &error);
+    // Unmap and remove the segment
+    void Close(void);
+    bool IsOpen(void) const { return (mHeader != 0); }
+
+    // Publish the latest sample and add it to the history (seq and index are set here)
+    void Publish(const GalilTelemetrySample &sample);
+
+protected:
+
+    std::string           mName;
+    GalilTelemetryHeader *mHeader;
+    GalilTelemetrySample *mHistory;
+    size_t                mSize;
+
+    static void WriteSample(GalilTelemetrySample *dest, const GalilTelemetrySample &src, uint64_t index);
+};
+
+#endif // _GalilTelemetryWriter_h
@@ -13,14 +13,40 @@ http://www.cisst.org/cisst/license.txt.
 --- end cisst license ---
 */
 
+#include <cstdlib>
+#include <cstdarg>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <time.h>
+
 #include <gclib.h>
 #include <gclibo.h>
 
+#include <cisstCommon/cmnPortability.h>
+#if (CISST_OS == CISST_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#endif
 #include <cisstCommon/cmnPath.h>
 #include <cisstCommon/cmnAssert.h>
+#include <cisstOSAbstraction/osaGetTime.h>
+#include <cisstOSAbstraction/osaSleep.h>
+#include <cisstMultiTask/mtsManagerLocal.h>
+#include <cisstMultiTask/mtsCallableVoidMethod.h>
 
 #include <sawGalilController/mtsGalilController.h>
 
+#include "GalilCommandPipeline.h"
+#include "GalilClockEstimator.h"
+#include "GalilDataRecordSocket.h"
+#include "GalilProgram.h"
+#include "GalilTelemetryWriter.h"
+
 enum GALIL_STATES { ST_IDLE, ST_HOMING };
 
 //****** Axis Data structures in DR packet ******
@@ -102,6 +128,46 @@ const uint8_t SC_OnError  =  8;   // Stopped by Off on Error (OE)
 const uint8_t SC_FindEdge =  9;   // Stopped after finding edge (FE)
 const uint8_t SC_Homing   = 10;   // Stopped after homing (HM) or find index (FI)
 
+// Controller variables used to store the hash of the downloaded DMC program and the
+// time (in msec) that the download took
+#define DMC_HASH_VAR  "dmchash"
+#define DMC_TIME_VAR  "dmcdlms"
+
+// FNV-1a hash, limited to 31 bits so that it fits in a (positive) Galil variable
+static int32_t ProgramHash(const std::string &program)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < program.size(); i++) {
+        hash ^= static_cast<uint8_t>(program[i]);
+        hash *= 16777619u;
+    }
+    return static_cast<int32_t>(hash & 0x7fffffff);
+}
+
+// Names of repeated error sources (see ErrorSource)
+static const char *ErrorSourceNames[] = { "GRecord", "SendCommand", "pipelined command" };
+
+// Names of bring-up phases (see BringUpPhase)
+static const char *BringUpPhaseNames[] = { "connecting", "detecting model", "downloading program",
+                                           "setting parameters", "opening helper connections",
+                                           "starting data record" };
+
+// Number of consecutive GRecord errors before the connection is considered lost
+const unsigned int DR_ERRORS_DISCONNECT = 5;
+// Period of Run when not connected (s)
+const double DISCONNECTED_PERIOD = 0.1;
+
+// Interrupt status bytes (see EI command)
+const uint8_t EI_AxisComplete  = 0xD0;   // Motion complete for axis A (add Galil index for B-H)
+const uint8_t EI_AllComplete   = 0xD8;   // Motion complete for all axes
+const uint8_t EI_LimitSwitch   = 0xC0;   // Limit switch occurred
+const uint8_t EI_InputLow      = 0xE1;   // Input 1 going low (add input-1 for inputs 2-8)
+const uint8_t EI_InputLowLast  = 0xE8;   // Input 8 going low
+
+// Bit masks for first argument of EI command
+const unsigned int EI_MaskLimitSwitch = 0x0400;  // Bit 10
+const unsigned int EI_MaskInputs      = 0x8000;  // Bit 15 (inputs selected by second argument)
+
 // Following is information specific to the different Galil DMC controller models.
 // There currently are 6 different DMC model types. We do not support any RIO controllers.
 // Note also the Galil QZ command, which returns information about the DR structure.
@@ -114,6 +180,10 @@ const unsigned int ModelTypes[NUM_MODELS]     = {  4000, 52000,  1806,  2103,  1
 const unsigned int AxisDataOffset[NUM_MODELS] = {    82,    82,    78 ,   44,    40,    38 };
 // Size of the axis data
 const size_t AxisDataSize[NUM_MODELS]         = { ADmax, ADmax, ADmin, ADmin, ADmin, ADmax };
+// DMC program limits (see Galil user manuals)
+const size_t ProgramMaxLines[NUM_MODELS]      = {  4000,  4000,  2000,  1000,  1000,  2000 };
+const size_t ProgramMaxLabels[NUM_MODELS]     = {   510,   510,   510,   254,   254,   254 };
+const size_t ProgramMaxLineLength = 80;
 // Whether the first 4 bytes contain header information
 // For DMC-4143, the header bytes are: 135 (0x87), 15 (0x0f), 226 , 0
 //   0x87 MSB always set; 7 indicates that I (Input), T (T Plane) and S (S Plane) blocks present
@@ -129,23 +199,148 @@ const int AmpStatusOffset[NUM_MODELS]          = {   52,    52,    -1,    -1,
 
 CMN_IMPLEMENT_SERVICES_DERIVED_ONEARG(mtsGalilController, mtsTaskContinuous, mtsStdString)
 
+// Parse numbers separated by commas and/or whitespace (e.g., " 1.0000, 2.0000" or
+// " 1.0000 2.0000"), storing at most maxValues. Returns number of values parsed.
+static size_t ParseValues(const char *str, double *values, size_t maxValues)
+{
+    size_t num = 0;
+    const char *p = str;
+    while (num < maxValues) {
+        while ((*p == ',') || (*p == ' ') || (*p == '\r') || (*p == '\n'))
+            p++;
+        if (*p == 0)
+            break;
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p)
+            break;      // Not a number
+        values[num++] = value;
+        p = end;
+    }
+    return num;
+}
+
+// Host time (s) for clock synchronization; CLOCK_MONOTONIC where available, since it is not
+// affected by adjustments of the system time
+static double HostMonotonicTime(void)
+{
+#if (CISST_OS == CISST_LINUX) || (CISST_OS == CISST_DARWIN)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1.0e-9;
+#else
+    return osaGetTime();
+#endif
+}
+
+// Apply the scheduling policy, priority and CPU affinity to the calling thread and prefault
+// its stack. Returns false, with the reason in error, if a setting could not be applied (e.g.,
+// no privileges for real-time scheduling), in which case the thread continues with the
+// default settings.
+static bool ApplyThreadSettings(const sawGalilControllerConfig::realtime_thread &settings,
+                                std::string &error)
+{
+    bool ok = true;
+#if (CISST_OS == CISST_LINUX)
+    int policy = SCHED_OTHER;
+    if (settings.policy == "fifo")
+        policy = SCHED_FIFO;
+    else if (settings.policy == "rr")
+        policy = SCHED_RR;
+    else if (settings.policy != "other") {
+        error = "unknown scheduling policy \"" + settings.policy + "\"";
+        ok = false;
+    }
+    if (policy != SCHED_OTHER) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = settings.priority;
+        int ret = pthread_setschedparam(pthread_self(), policy, &param);
+        if (ret != 0) {
+            error = "could not set scheduling policy " + settings.policy + ": " + strerror(ret);
+            ok = false;
+        }
+    }
+    if (!settings.cpus.empty()) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (size_t i = 0; i < settings.cpus.size(); i++)
+            CPU_SET(settings.cpus[i], &cpuSet);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if (ret != 0) {
+            error = std::string("could not set CPU affinity: ") + strerror(ret);
+            ok = false;
+        }
+    }
+    if (settings.prefault_stack_kb > 0) {
+        // Touch each page, so that page faults do not occur later (with mlockall, the
+        // pages then remain in memory)
+        size_t size = settings.prefault_stack_kb*1024;
+        volatile char *stack = static_cast<volatile char *>(alloca(size));
+        for (size_t i = 0; i < size; i += 4096)
+            stack[i] = 0;
+    }
+#else
+    if ((settings.policy != "other") || !settings.cpus.empty()) {
+        error = "real-time settings not supported on this platform";
+        ok = false;
+    }
+#endif
+    return ok;
+}
+
+// Lock all current and future memory (mlockall) and prefault the heap
+static bool LockMemory(bool lock, unsigned int prefaultHeapKB, std::string &error)
+{
+#if (CISST_OS == CISST_LINUX)
+    if (lock) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            error = std::string("could not lock memory: ") + strerror(errno);
+            return false;
+        }
+        // Do not return freed memory to the system, so that the prefaulted heap is reused
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+    if (prefaultHeapKB > 0) {
+        size_t size = prefaultHeapKB*1024;
+        char *heap = static_cast<char *>(malloc(size));
+        if (heap) {
+            for (size_t i = 0; i < size; i += 4096)
+                heap[i] = 0;
+            free(heap);
+        }
+    }
+    return true;
+#else
+    if (lock || (prefaultHeapKB > 0)) {
+        error = "memory locking not supported on this platform";
+        return false;
+    }
+    return true;
+#endif
+}
+
 mtsGalilController::mtsGalilController(const std::string &name) :
     mtsTaskContinuous(name, 1024, true), mGalil(0), mHeader(0), mAmpStatus(0),
-    mMotorPowerOn(false), mMotionActive(false), mState(ST_IDLE)
+    mMotorPowerOn(false), mMotionActive(false), mState(ST_IDLE), mServoSuperseded(0),
+    mCommandsSuppressed(0), mJogActive(false), mJogSettleCycles(0)
 {
     Init();
 }
 
 mtsGalilController::mtsGalilController(const std::string &name, unsigned int sizeStateTable, bool newThread) :
     mtsTaskContinuous(name, sizeStateTable, newThread), mGalil(0), mHeader(0), mAmpStatus(0),
-    mMotorPowerOn(false), mMotionActive(false), mState(ST_IDLE)
+    mMotorPowerOn(false), mMotionActive(false), mState(ST_IDLE), mServoSuperseded(0),
+    mCommandsSuppressed(0), mJogActive(false), mJogSettleCycles(0)
 {
     Init();
 }
 
 mtsGalilController::mtsGalilController(const mtsTaskContinuousConstructorArg & arg) :
     mtsTaskContinuous(arg), mGalil(0), mHeader(0),mAmpStatus(0),  mMotorPowerOn(false), mMotionActive(false),
-    mState(ST_IDLE)
+    mState(ST_IDLE), mServoSuperseded(0),
+    mCommandsSuppressed(0), mJogActive(false), mJogSettleCycles(0)
 {
     Init();
 }
@@ -153,14 +348,122 @@ mtsGalilController::mtsGalilController(const mtsTaskContinuousConstructorArg & a
 mtsGalilController::~mtsGalilController()
 {
     Close();
+    delete mPipeline;
+    delete mClock;
+    delete mDRSocket;
+    delete mTelemetry;
+    delete mCommandQueuedCallable;
     delete [] mBuffer;
 }
 
+mtsInterfaceProvided *mtsGalilController::AddInterfaceProvidedWithoutSystemEvents(const std::string &interfaceProvidedName,
+                                                                                   mtsInterfaceQueueingPolicy queueingPolicy,
+                                                                                   bool isProxy)
+{
+    if ((queueingPolicy != MTS_COMPONENT_POLICY) && (queueingPolicy != MTS_COMMANDS_SHOULD_BE_QUEUED))
+        return mtsTaskContinuous::AddInterfaceProvidedWithoutSystemEvents(interfaceProvidedName, queueingPolicy, isProxy);
+    mtsInterfaceProvided *interfaceProvided = new mtsInterfaceProvided(interfaceProvidedName, this,
+                                                                       MTS_COMMANDS_SHOULD_BE_QUEUED,
+                                                                       mCommandQueuedCallable, isProxy);
+    if (InterfacesProvided.AddItem(interfaceProvidedName, interfaceProvided)) {
+        InterfacesProvidedOrderedList.push_back(interfaceProvided);
+        return interfaceProvided;
+    }
+    CMN_LOG_CLASS_INIT_ERROR << "AddInterfaceProvided: unable to add interface \""
+                             << interfaceProvidedName << "\"" << std::endl;
+    delete interfaceProvided;
+    return 0;
+}
+
 void mtsGalilController::Init(void)
 {
     // Call SetupInterfaces after Configure, for reasons documented below
     // (see comment at end of Configure method).
     mBuffer = new char[G_SMALL_BUFFER];
+    mGalilDR = 0;
+    mGalilMsg = 0;
+    mGalilEI = 0;
+    mPipeline = new GalilCommandPipeline;
+    mClock = new GalilClockEstimator;
+    mDRSocket = new GalilDataRecordSocket;
+    mCommandQueuedCallable = new mtsCallableVoidMethod<mtsGalilController>(&mtsGalilController::CommandQueued, this);
+    mTelemetry = new GalilTelemetryWriter;
+    memset(&mTelemetrySample, 0, sizeof(mTelemetrySample));
+    mDRTimes.SetSize(2);
+    mDRTimes.SetAll(0.0);
+    mBatchActive = false;
+    mBatchUsed = 0;
+    mBatchNum = 0;
+    mDRLastArrival = 0.0;
+    mDRLastProcess = 0.0;
+    mRealtimeApplied = false;
+    // Messages from Run are formatted into these strings, to avoid allocating memory
+    mRunMessage.reserve(2*RUN_MESSAGE_SIZE);
+    mBringUpThreadId = std::thread::id();
+    mDMCMessage.reserve(MESSAGE_LINE_SIZE);
+    mJitterBefore.Reset(JITTER_BINS);
+    mJitterAfter.Reset(JITTER_BINS);
+    mDRPeriod = 0;
+    mDRIdle = false;
+    mDRLastActivity = 0.0;
+    mDRRateLastTime = 0.0;
+    mDRHandle = -1;
+    mDRRateTime.SetSize(2);
+    mDRRateTime.SetAll(0.0);
+    mMessageThreadRunning = false;
+    mMessagesDroppedCount = 0;
+    mMessagesDropped = 0;
+    mInterruptThreadRunning = false;
+    mDRThreadRunning = false;
+    mDRRateRequest = -1;
+    mGalilStop = 0;
+    mStopCmdST[0] = 0;
+    mStopCmdMO[0] = 0;
+    mStopRequest = 0;
+    mStopSent = 0;
+    mDiscardMotion = false;
+    mMotionDiscarded = 0;
+    mMotionDiscardedTotal = 0;
+    mDRDroppedCount = 0;
+    mDRDropped = 0;
+    mSnapshotNew = false;
+    mHistory.resize(StateTable.GetHistoryLength());
+    mHistoryHead = 0;
+    mQueryNext = 0;
+    mVariableQueryNext = 0;
+    mDRErrors = 0;
+    for (size_t i = 0; i < ERROR_TABLE_SIZE; i++) {
+        mErrorTable[i].source = -1;
+        mErrorTable[i].active = false;
+    }
+    mActiveErrors = 0;
+    mErrorCounters.sources.SetSize(ERROR_TABLE_SIZE);
+    mErrorCounters.codes.SetSize(ERROR_TABLE_SIZE);
+    mErrorCounters.counts.SetSize(ERROR_TABLE_SIZE);
+    mErrorCounters.active.SetSize(ERROR_TABLE_SIZE);
+    UpdateErrorCounters();
+    mWasConnected = false;
+    mSamplePeriod = 0.001;
+    mSchedulePending = false;
+    mScheduleTarget = 0;
+    mReconnectThreadRunning = false;
+    mReconnectReady = false;
+    mConnectionState = CONNECTION_DISCONNECTED;
+    mBringUpDone = false;
+    mBringUpOk = false;
+    mBringUpMotionOk = false;
+    mBringUpPhase = PHASE_NUM;
+    mBringUpPhaseReported = PHASE_NUM;
+    mBringUpPhaseStart = 0.0;
+    mStartupTimes.SetSize(PHASE_NUM);
+    mStartupTimes.SetAll(0.0);
+    for (size_t i = 0; i < GALIL_MAX_AXES; i++) {
+        mMotionCompleteTimeEI[i] = 0.0;
+        mMotionCompleteTimeDR[i] = 0.0;
+        mAxisWasMoving[i] = false;
+    }
+    mServoMailbox.mode = SERVO_NONE;
+    ShadowInvalidateAll();
 }
 
 void mtsGalilController::SetupInterfaces(void)
@@ -176,14 +479,58 @@ void mtsGalilController::SetupInterfaces(void)
     StateTable.AddData(mSwitches, "switches");
     StateTable.AddData(mAnalogIn, "analog_in");
     StateTable.AddData(mActuatorState, "actuator_state");
+    StateTable.AddData(mSnapshot, "snapshot");
+    StateTable.AddData(mDRStatistics, "dr_statistics");
+    StateTable.AddData(mClockSync, "clock_sync");
+    StateTable.AddData(mErrorCounters, "error_counters");
+    StateTable.AddData(mDRTimes, "dr_times");
+    StateTable.AddData(mDRWakeLatency, "dr_wake_latency");
+    StateTable.AddData(mJitterBefore, "jitter_before");
+    StateTable.AddData(mJitterAfter, "jitter_after");
+    // Timestamps set in Run (time of sample, rather than time of state table advance)
+    m_measured_js.SetAutomaticTimestamp(false);
+    m_setpoint_js.SetAutomaticTimestamp(false);
+    mActuatorState.SetAutomaticTimestamp(false);
+    StateTable.AddData(mDRPeriod, "dr_period");
+    StateTable.AddData(mDRIdle, "dr_idle");
+    StateTable.AddData(mPeriodActive, "period_active");
+    StateTable.AddData(mPeriodIdle, "period_idle");
+    StateTable.AddData(mDRRateTime, "dr_rate_time");
+    StateTable.AddData(mStartupTimes, "startup_times");
+    StateTable.AddData(mCommandStatistics, "command_statistics");
+    StateTable.AddData(mPipelineStatistics, "pipeline_statistics");
     StateTable.AddData(mSpeed, "speed");
     StateTable.AddData(mAccel, "accel");
     StateTable.AddData(mDecel, "decel");
+    StateTable.AddData(mServoSuperseded, "servo_superseded");
+    StateTable.AddData(mCommandsSuppressed, "commands_suppressed");
+    StateTable.AddData(mMessagesDropped, "messages_dropped");
+    StateTable.AddData(mDRDropped, "dr_dropped");
+    StateTable.AddData(mDRQueueDelay, "dr_queue_delay");
+    StateTable.AddData(mStopLatency, "stop_latency");
+    StateTable.AddData(mMotionDiscardedTotal, "motion_discarded");
+    StateTable.AddData(mInterruptLatency, "interrupt_latency");
+    StateTable.AddData(mQueryResults, "query_results");
+    StateTable.AddData(mScheduleSkew, "schedule_skew");
 
     mInterface = AddInterfaceProvided("control");
     if (mInterface) {
         // for Status, Warning and Error with mtsMessage
         mInterface->AddMessageEvents();
+        // Unsolicited messages (MG) from the DMC program
+        mInterface->AddEventWrite(mDMCMessageEvent, "dmc_message", std::string());
+        // Interrupts (EI)
+        mInterface->AddEventWrite(mMotionCompleteEvent, "motion_complete", mMotionCompleteMask);
+        mInterface->AddEventVoid(mLimitSwitchEvent, "limit_switch");
+        // DR period changes (adaptive DR rate)
+        mInterface->AddEventWrite(mDRPeriodEvent, "dr_period", int(0));
+        // Connection state changes
+        mInterface->AddEventWrite(mConnectedEvent, "connected", false);
+        // Bring-up progress (phase name, then "ready" or "failed")
+        mInterface->AddEventWrite(mStartupPhaseEvent, "startup_phase", std::string());
+        mInterface->AddEventWrite(mInputInterruptEvent, "input_interrupt", int(0));
+        // State from each DR (if snapshot_event)
+        mInterface->AddEventWrite(mSnapshotEvent, "snapshot", mSnapshot);
 
         // Standard CRTK interfaces
         mInterface->AddCommandReadState(this->StateTable, m_measured_js, "measured_js");
@@ -192,17 +539,38 @@ void mtsGalilController::SetupInterfaces(void)
         mInterface->AddCommandWrite(&mtsGalilController::servo_jp, this, "servo_jp");
         mInterface->AddCommandWrite(&mtsGalilController::servo_jr, this, "servo_jr");
         mInterface->AddCommandWrite(&mtsGalilController::servo_jv, this, "servo_jv");
-        mInterface->AddCommandVoid(&mtsGalilController::hold, this, "hold");
+        // Stop-class commands are not queued (see RequestStop)
+        mInterface->AddCommandVoid(&mtsGalilController::RequestHold, this, "hold", MTS_COMMAND_NOT_QUEUED);
         mInterface->AddCommandRead(&mtsGalilController::GetConfig_js, this, "configuration_js");
 
         mInterface->AddCommandVoid(&mtsGalilController::EnableMotorPower, this, "EnableMotorPower");
-        mInterface->AddCommandVoid(&mtsGalilController::DisableMotorPower, this, "DisableMotorPower");
+        mInterface->AddCommandVoid(&mtsGalilController::RequestMotorOff, this, "DisableMotorPower",
+                                   MTS_COMMAND_NOT_QUEUED);
 
         // TEMP: following is to be able to use prmStateRobotQtWidgetComponent
         mInterface->AddCommandRead(&mtsGalilController::measured_cp, this, "measured_cp");
 
         // Stats
         mInterface->AddCommandReadState(StateTable, StateTable.PeriodStats, "period_statistics");
+        mInterface->AddCommandReadState(StateTable, mDRStatistics, "GetDRStatistics");
+        mInterface->AddCommandReadState(StateTable, mClockSync, "GetClockSync");
+        mInterface->AddCommandReadState(StateTable, mErrorCounters, "GetErrorCounters");
+        mInterface->AddCommandRead(&mtsGalilController::GetErrorSourceNames, this, "GetErrorSourceNames");
+        mInterface->AddCommandReadState(StateTable, mDRTimes, "GetDRTimes");
+        mInterface->AddCommandReadState(StateTable, mDRWakeLatency, "GetDRWakeLatency");
+        mInterface->AddCommandReadState(StateTable, mJitterBefore, "GetJitterHistogramBefore");
+        mInterface->AddCommandReadState(StateTable, mJitterAfter, "GetJitterHistogramAfter");
+        mInterface->AddCommandReadState(StateTable, mDRPeriod, "GetDRPeriod");
+        mInterface->AddCommandReadState(StateTable, mDRIdle, "GetDRIdle");
+        mInterface->AddCommandReadState(StateTable, mPeriodActive, "GetPeriodStatisticsActive");
+        mInterface->AddCommandReadState(StateTable, mPeriodIdle, "GetPeriodStatisticsIdle");
+        mInterface->AddCommandReadState(StateTable, mDRRateTime, "GetDRRateTime");
+        mInterface->AddCommandReadState(StateTable, mStartupTimes, "GetStartupTimes");
+        mInterface->AddCommandRead(&mtsGalilController::GetStartupPhaseNames, this, "GetStartupPhaseNames");
+        mInterface->AddCommandVoid(&mtsGalilController::ResetDRStatistics, this, "ResetDRStatistics");
+        mInterface->AddCommandReadState(StateTable, mCommandStatistics, "GetCommandStatistics");
+        mInterface->AddCommandReadState(StateTable, mPipelineStatistics, "GetPipelineStatistics");
+        mInterface->AddCommandVoid(&mtsGalilController::ResetCommandStatistics, this, "ResetCommandStatistics");
 
         // Extra stuff
         mInterface->AddCommandRead(&mtsGalilController::GetNumAxes, this, "GetNumAxes");
@@ -212,9 +580,16 @@ void mtsGalilController::SetupInterfaces(void)
         mInterface->AddCommandRead(&mtsGalilController::GetConnected, this, "GetConnected");
         mInterface->AddCommandWrite(&mtsGalilController::SendCommand, this, "SendCommand");
         mInterface->AddCommandWriteReturn(&mtsGalilController::SendCommandRet, this, "SendCommandRet");
+        mInterface->AddCommandWriteReturn(&mtsGalilController::ReadVariables, this, "ReadVariables");
+        mInterface->AddCommandWrite(&mtsGalilController::WriteVariables, this, "WriteVariables");
+        mInterface->AddCommandWrite(&mtsGalilController::ScheduleCommand, this, "ScheduleCommand");
+        mInterface->AddCommandReadState(this->StateTable, mScheduleSkew, "GetScheduleSkew");
         mInterface->AddCommandReadState(this->StateTable, mAnalogIn, "GetAnalogInput");
         mInterface->AddCommandVoid(&mtsGalilController::AbortProgram, this, "AbortProgram");
-        mInterface->AddCommandVoid(&mtsGalilController::AbortMotion, this, "AbortMotion");
+        mInterface->AddCommandVoid(&mtsGalilController::RequestAbortMotion, this, "AbortMotion",
+                                   MTS_COMMAND_NOT_QUEUED);
+        mInterface->AddCommandReadState(StateTable, mStopLatency, "GetStopLatency");
+        mInterface->AddCommandReadState(StateTable, mMotionDiscardedTotal, "GetMotionDiscarded");
         mInterface->AddCommandWrite(&mtsGalilController::SetSpeed, this, "SetSpeed");
         mInterface->AddCommandWrite(&mtsGalilController::SetAccel, this, "SetAccel");
         mInterface->AddCommandWrite(&mtsGalilController::SetDecel, this, "SetDecel");
@@ -227,20 +602,414 @@ void mtsGalilController::SetupInterfaces(void)
         mInterface->AddCommandReadState(this->StateTable, mSpeed, "GetSpeed");
         mInterface->AddCommandReadState(this->StateTable, mAccel, "GetAccel");
         mInterface->AddCommandReadState(this->StateTable, mDecel, "GetDecel");
+        mInterface->AddCommandReadState(this->StateTable, mServoSuperseded, "GetServoSuperseded");
+        mInterface->AddCommandReadState(this->StateTable, mCommandsSuppressed, "GetCommandsSuppressed");
+        mInterface->AddCommandReadState(this->StateTable, mMessagesDropped, "GetMessagesDropped");
+        mInterface->AddCommandReadState(this->StateTable, mDRDropped, "GetDRDropped");
+        mInterface->AddCommandReadState(this->StateTable, mDRQueueDelay, "GetDRQueueDelay");
+        mInterface->AddCommandReadState(this->StateTable, mInterruptLatency, "GetInterruptLatency");
+        mInterface->AddCommandReadState(this->StateTable, mQueryResults, "GetQueryResults");
+        mInterface->AddCommandRead(&mtsGalilController::GetQueryNames, this, "GetQueryNames");
         // Low-level axis data for testing
         mInterface->AddCommandReadState(this->StateTable, mAxisStatus, "GetAxisStatus");
+        mInterface->AddCommandReadState(this->StateTable, mSnapshot, "ReadState");
+        mInterface->AddCommandWriteReturn(&mtsGalilController::GetHistorySince, this, "GetHistorySince",
+                                          GalilHistoryRequest(), GalilHistory());
         mInterface->AddCommandReadState(this->StateTable, mStopCode, "GetStopCode");
         mInterface->AddCommandReadState(this->StateTable, mSwitches, "GetSwitches");
     }
 }
 
-void mtsGalilController::Close()
+bool mtsGalilController::OpenConnection(void **galil, const char *options, const char *description)
 {
+    std::string GalilString = m_configuration.IP_address;
+    if (m_configuration.direct_mode) {
+        GalilString.append(" -d");
+    }
+    if (options) {
+        GalilString.append(" ");
+        GalilString.append(options);
+    }
+    GReturn ret = GOpen(GalilString.c_str(), galil);
+    if (ret != G_NO_ERROR) {
+        *galil = 0;
+        ReportMessage(MSG_ERROR, this->GetName() + ": error opening " + m_configuration.IP_address
+                      + " (" + description + ")");
+        CMN_LOG_CLASS_INIT_ERROR << "Galil GOpen: error opening " << m_configuration.IP_address
+                                 << " for " << description << ": " << ret << std::endl;
+        return false;
+    }
+    return true;
+}
 
+void mtsGalilController::Close()
+{
+    StopDRThread();
+    mStopMutex.Lock();
+    if (mGalilStop) {
+        GClose(mGalilStop);
+        mGalilStop = 0;
+    }
+    mStopMutex.Unlock();
+    if (mMessageThreadRunning) {
+        mMessageThreadRunning = false;
+        mMessageThread.Wait();
+    }
+    if (mInterruptThreadRunning) {
+        mInterruptThreadRunning = false;
+        mInterruptThread.Wait();
+    }
+    if (mGalilEI) {
+        if (mGalil)
+            GCmd(mGalil, "EI 0,0");   // Disable interrupts
+        GClose(mGalilEI);
+        mGalilEI = 0;
+    }
+    if (mGalilMsg) {
+        GClose(mGalilMsg);
+        mGalilMsg = 0;
+    }
+    if (mGalilDR) {
+        GClose(mGalilDR);
+        mGalilDR = 0;
+    }
+    mDRSocket->Close();
     if (mGalil) {
         GClose(mGalil);
         mGalil = 0;
     }
+    mPipeline->Close();
+}
+
+// Reads unsolicited messages (MG) from the controller, so that they do not
+// accumulate on the controller, and splits them into lines (without allocating memory).
+// GMessage does not necessarily return complete lines, so a partial line is kept
+// until its end of line is received.
+void *mtsGalilController::MessageThreadRun(int)
+{
+    std::string error;
+    if (!ApplyThreadSettings(m_configuration.realtime.message_thread, error))
+        CMN_LOG_CLASS_INIT_WARNING << "MessageThreadRun: " << error << std::endl;
+    char buf[G_SMALL_BUFFER];
+    char line[MESSAGE_LINE_SIZE];
+    size_t len = 0;
+    while (mMessageThreadRunning) {
+        GReturn ret = GMessage(mGalilMsg, buf, sizeof(buf));
+        if (ret != G_NO_ERROR)
+            continue;    // Most likely a timeout
+        for (const char *p = buf; *p; p++) {
+            if ((*p != '\r') && (*p != '\n')) {
+                if (len < MESSAGE_LINE_SIZE-1)
+                    line[len++] = *p;    // Longer lines are truncated
+                continue;
+            }
+            if (len == 0)
+                continue;                // Empty line (or second char of CR/LF)
+            line[len] = 0;
+            len = 0;
+            MessageLine *slot = mMessageQueue.GetWriteSlot();
+            if (slot) {
+                memcpy(slot->text, line, sizeof(line));
+                mMessageQueue.Push();
+            }
+            else {
+                mMessagesDroppedCount++;
+            }
+        }
+    }
+    return 0;
+}
+
+void *mtsGalilController::InterruptThreadRun(int)
+{
+    std::string error;
+    if (!ApplyThreadSettings(m_configuration.realtime.interrupt_thread, error))
+        CMN_LOG_CLASS_INIT_WARNING << "InterruptThreadRun: " << error << std::endl;
+    while (mInterruptThreadRunning) {
+        GStatus status = 0;
+        GReturn ret = GInterrupt(mGalilEI, &status);
+        if ((ret != G_NO_ERROR) || (status == 0))
+            continue;    // Most likely a timeout
+        InterruptEvent *slot = mInterruptQueue.GetWriteSlot();
+        if (slot) {
+            slot->status = status;
+            slot->time = osaGetTime();
+            mInterruptQueue.Push();
+        }
+    }
+    return 0;
+}
+
+void mtsGalilController::ProcessInterrupts(void)
+{
+    const InterruptEvent *intr;
+    while ((intr = mInterruptQueue.GetReadSlot()) != 0) {
+        uint8_t status = intr->status;
+        double time = intr->time;
+        mInterruptQueue.Pop();
+        if ((status >= EI_AxisComplete) && (status <= EI_AllComplete)) {
+            mMotionCompleteMask.SetAll(false);
+            for (size_t i = 0; i < mNumAxes; i++) {
+                if ((status == EI_AllComplete) ||
+                    (mAxisToGalilIndexMap[i] == static_cast<unsigned int>(status - EI_AxisComplete))) {
+                    mMotionCompleteMask[i] = true;
+                    mMotionCompleteTimeEI[i] = time;
+                    UpdateInterruptLatency(i);
+                }
+            }
+            if (mMotionCompleteMask.Any())
+                mMotionCompleteEvent(mMotionCompleteMask);
+        }
+        else if (status == EI_LimitSwitch) {
+            mLimitSwitchEvent();
+        }
+        else if ((status >= EI_InputLow) && (status <= EI_InputLowLast)) {
+            mInputInterruptEvent(static_cast<int>(status - EI_InputLow + 1));
+        }
+        else {
+            CMN_LOG_CLASS_RUN_VERBOSE << "ProcessInterrupts: ignoring status byte 0x"
+                                      << std::hex << static_cast<unsigned int>(status)
+                                      << std::dec << std::endl;
+        }
+    }
+}
+
+void mtsGalilController::UpdateInterruptLatency(size_t axis)
+{
+    if ((mMotionCompleteTimeEI[axis] > 0.0) && (mMotionCompleteTimeDR[axis] > 0.0)) {
+        double latency = mMotionCompleteTimeDR[axis] - mMotionCompleteTimeEI[axis];
+        // Ignore unrelated events, e.g., a move that was too short to be seen in DR
+        if (std::abs(latency) < 0.5)
+            mInterruptLatency.Update(latency);
+        mMotionCompleteTimeEI[axis] = 0.0;
+        mMotionCompleteTimeDR[axis] = 0.0;
+    }
+}
+
+bool mtsGalilController::SetDRRate(bool idle)
+{
+    int period = idle ? m_configuration.DR_idle_period_ms : m_configuration.DR_period_ms;
+    if (mDRThreadRunning && (mDRHandle >= 0)) {
+        // Set the rate of the DR handle on the command connection, so that it takes effect
+        // immediately (e.g., when a motion command is received at the idle rate)
+        char cmd[32];
+        sprintf(cmd, "DR %u,%d", DRPeriodToSamples(period), mDRHandle);
+        if (!SendGalilCommand(cmd))
+            return false;
+    }
+    else if (mDRThreadRunning) {
+        // The DR connection is only used by the DR thread, which sets the rate (and logs
+        // any error) before reading the next record
+        mDRRateRequest = period;
+    }
+    else if (!SetRecordRate(period)) {
+        CMN_LOG_CLASS_RUN_ERROR << "SetDRRate: error setting rate to "
+                                << period << " ms" << std::endl;
+        return false;
+    }
+    mDRIdle = idle;
+    mDRPeriod = period;
+    // Do not use the next arrival for the DR statistics, since it spans the rate change
+    mDRLastArrival = 0.0;
+    mDRLastProcess = 0.0;
+    mDRPeriodEvent(mDRPeriod);
+    CMN_LOG_CLASS_RUN_VERBOSE << "SetDRRate: DR period set to " << period << " ms" << std::endl;
+    return true;
+}
+
+// DR period (DR command) is specified in samples
+unsigned int mtsGalilController::DRPeriodToSamples(int periodMs) const
+{
+    unsigned int samples = static_cast<unsigned int>(periodMs*1.0e-3/mSamplePeriod + 0.5);
+    if ((periodMs > 0) && (samples < 2))
+        samples = 2;
+    return samples;
+}
+
+bool mtsGalilController::SetRecordRate(int periodMs)
+{
+    if (mDRSocket->IsOpen())
+        return mDRSocket->SetRate(DRPeriodToSamples(periodMs));
+    return (GRecordRate(mGalilDR, periodMs) == G_NO_ERROR);
+}
+
+// Reads the DR (gclib or DR socket) and queues it for Run, which is then woken up. Errors
+// are also queued; timeouts are only queued if there has been no DR for the DR timeout
+// (the reads themselves time out sooner, so that the thread can be stopped).
+void *mtsGalilController::DRThreadRun(int)
+{
+    std::string error;
+    if (!ApplyThreadSettings(m_configuration.realtime.receiver_thread, error))
+        CMN_LOG_CLASS_INIT_WARNING << "DRThreadRun: " << error << std::endl;
+    GDataRecord rec;
+    const double drTimeout = std::max(0.5, 0.003*std::max(m_configuration.DR_period_ms,
+                                                          m_configuration.DR_idle_period_ms));
+    double lastRecord = HostMonotonicTime();
+    while (mDRThreadRunning) {
+        int period = mDRRateRequest.exchange(-1);
+        if ((period >= 0) && !SetRecordRate(period)) {
+            CMN_LOG_CLASS_RUN_ERROR << "DRThreadRun: error setting DR rate to "
+                                    << period << " ms" << std::endl;
+        }
+        double kernelTime, userTime;
+        GReturn ret;
+        if (mDRSocket->IsOpen()) {
+            ret = (mDRSocket->Receive(&rec, sizeof(rec), DR_READ_TIMEOUT_MS, kernelTime, userTime) > 0)
+                  ? G_NO_ERROR : G_TIMEOUT;
+        }
+        else {
+            ret = GRecord(mGalilDR, &rec, G_DR);
+            userTime = HostMonotonicTime();
+            kernelTime = userTime;
+        }
+        if (ret == G_NO_ERROR)
+            lastRecord = userTime;
+        else if (ret == G_TIMEOUT) {
+            if (userTime - lastRecord < drTimeout)
+                continue;
+            lastRecord = userTime;
+        }
+        DataRecordSlot *slot = mDRQueue.GetWriteSlot();
+        if (slot) {
+            slot->ret = ret;
+            slot->kernelTime = kernelTime;
+            slot->userTime = userTime;
+            memcpy(slot->data, &rec, sizeof(rec));
+            mDRQueue.Push();
+        }
+        else
+            mDRDroppedCount++;    // Run is not keeping up
+        mRunSignal.Raise();
+    }
+    return 0;
+}
+
+void mtsGalilController::StartDRThread(void)
+{
+    static_assert(sizeof(GDataRecord) <= DR_RECORD_SIZE, "DR_RECORD_SIZE too small for GDataRecord");
+    // Discard records from a previous connection (Run does not read the queue while starting)
+    while (mDRQueue.GetReadSlot())
+        mDRQueue.Pop();
+    mDRRateRequest = -1;
+    if (mGalilDR)
+        GTimeout(mGalilDR, DR_READ_TIMEOUT_MS);   // So that the thread can be stopped
+    mDRThreadRunning = true;
+    mDRThread.Create<mtsGalilController, int>(this, &mtsGalilController::DRThreadRun, 0, "GalilDR");
+}
+
+void mtsGalilController::StopDRThread(void)
+{
+    if (mDRThreadRunning) {
+        mDRThreadRunning = false;
+        mDRThread.Wait();
+    }
+}
+
+void mtsGalilController::UpdateDRRate(double now)
+{
+    if (mDRRateLastTime > 0.0)
+        mDRRateTime[mDRIdle ? 1 : 0] += now - mDRRateLastTime;
+    mDRRateLastTime = now;
+    if (!mDRIdle && (m_configuration.DR_idle_period_ms > m_configuration.DR_period_ms) &&
+        (now - mDRLastActivity > m_configuration.DR_idle_timeout_s))
+        SetDRRate(true);
+}
+
+void mtsGalilController::DRActivity(void)
+{
+    mDRLastActivity = osaGetTime();
+    if (mDRIdle && mDRThreadRunning)
+        SetDRRate(false);
+}
+
+void mtsGalilController::RunQueries(void)
+{
+    // mQueries is modified by the bring-up thread (see Connect)
+    if (mConnectionState != CONNECTION_READY)
+        return;
+    size_t numQueries = mQueries.size();
+    if (numQueries == 0)
+        return;
+
+    const double budget = m_configuration.query_budget_us*1.0e-6;
+    const double startTime = osaGetTime();
+    double elapsed = 0.0;
+    char buffer[G_SMALL_BUFFER];
+    double values[GALIL_MAX_AXES];
+    for (size_t n = 0; n < numQueries; n++) {
+        size_t q = (mQueryNext + n) % numQueries;
+        ScheduledQuery &query = mQueries[q];
+        double now = startTime + elapsed;
+        if (now < query.nextTime)
+            continue;
+        if (query.cost > budget) {
+            if (!query.overBudget) {
+                CMN_LOG_CLASS_RUN_WARNING << "RunQueries: query \"" << query.command << "\" takes "
+                                          << query.cost*1.0e6 << " us, which exceeds budget of "
+                                          << m_configuration.query_budget_us << " us" << std::endl;
+                query.overBudget = true;
+            }
+            continue;
+        }
+        if (elapsed + query.cost > budget)
+            break;     // Wait for next cycle
+
+        char *result;
+        GReturn ret = GCmdT(mGalil, query.command.c_str(), buffer, sizeof(buffer), &result);
+        double dt = osaGetTime() - now;
+        elapsed += dt;
+        // Running estimate of the query duration
+        query.cost = (query.cost == 0.0) ? dt : (0.8*query.cost + 0.2*dt);
+        query.nextTime += query.period;
+        if (query.nextTime < now)
+            query.nextTime = now + query.period;
+        mQueryNext = (q + 1) % numQueries;
+
+        if (ret != G_NO_ERROR) {
+            CMN_LOG_CLASS_RUN_WARNING << "RunQueries: error " << ret << " for query \""
+                                      << query.command << "\"" << std::endl;
+            continue;
+        }
+        size_t numValues = ParseValues(result, values, GALIL_MAX_AXES);
+        if (query.row < 0) {
+            // Homed query: values are in the order of mGalilAxes
+            for (size_t i = 0; (i < numValues) && mGalilAxes[i]; i++) {
+                unsigned int axis = mGalilIndexToAxisMap[mGalilAxes[i]-'A'];
+                if (axis < mNumAxes)
+                    mIsHomed[axis] = (values[i] != 0.0);
+            }
+        }
+        else {
+            for (size_t i = 0; i < numValues; i++)
+                mQueryResults.Element(query.row, i) = values[i];
+        }
+    }
+}
+
+void mtsGalilController::ProcessMessages(void)
+{
+    // Limit the number of messages per cycle, the rest will be sent in the next cycles
+    for (unsigned int i = 0; i < MESSAGES_PER_CYCLE; i++) {
+        const MessageLine *msg = mMessageQueue.GetReadSlot();
+        if (!msg)
+            break;
+        // Skip leading whitespace (MG often starts with a space)
+        const char *text = msg->text;
+        while (*text == ' ')
+            text++;
+        // Both strings are reserved in Init
+        mDMCMessage.assign(text);
+        mMessageQueue.Pop();
+        FormatRunMessage("%s", mDMCMessage.c_str());
+        if (strncmp(mDMCMessage.c_str(), "ERR", 3) == 0)
+            mInterface->SendError(mRunMessage);
+        else if (strncmp(mDMCMessage.c_str(), "WARN", 4) == 0)
+            mInterface->SendWarning(mRunMessage);
+        else
+            mInterface->SendStatus(mRunMessage);
+        mDMCMessageEvent(mDMCMessage);
+    }
+    mMessagesDropped = mMessagesDroppedCount;
 }
 
 unsigned int mtsGalilController::GetModelIndex(unsigned int modelType)
@@ -322,6 +1091,7 @@ void mtsGalilController::Configure(const std::string& fileName)
     mStopCode.SetSize(mNumAxes);
     mSwitches.SetSize(mNumAxes);
     mAnalogIn.SetSize(mNumAxes);
+    mSnapshot.SetSize(mNumAxes);
 
     mSpeed.SetSize(mNumAxes);
     mSpeedDefault.SetSize(mNumAxes);
@@ -330,6 +1100,33 @@ void mtsGalilController::Configure(const std::string& fileName)
     mDecel.SetSize(mNumAxes);
     mDecelDefault.SetSize(mNumAxes);
 
+    mServoMailbox.goal.SetSize(mNumAxes);
+    mMotionCompleteMask.SetSize(mNumAxes);
+    mMotionCompleteMask.SetAll(false);
+    mIsHomed.SetSize(mNumAxes);
+    mIsHomed.SetAll(false);
+    mScheduleAxes.SetSize(mNumAxes);
+    mScheduleAxes.SetAll(false);
+
+    // Configured queries (see RunQueries)
+    size_t numQueries = m_configuration.queries.size();
+    mQueries.clear();
+    mQueryNames.resize(numQueries);
+    mQueryResults.SetSize(numQueries, GALIL_MAX_AXES);
+    mQueryResults.SetAll(0.0);
+    for (size_t q = 0; q < numQueries; q++) {
+        const sawGalilControllerConfig::query &queryConfig = m_configuration.queries[q];
+        ScheduledQuery query;
+        query.command = queryConfig.command;
+        query.period = queryConfig.period;
+        query.nextTime = 0.0;
+        query.cost = 0.0;
+        query.overBudget = false;
+        query.row = static_cast<int>(q);
+        mQueries.push_back(query);
+        mQueryNames[q] = queryConfig.name.empty() ? queryConfig.command : queryConfig.name;
+    }
+
     mGalilIndexMax = 0;
     unsigned int i;
     for (i = 0; i < GALIL_MAX_AXES; i++)
@@ -374,10 +1171,37 @@ void mtsGalilController::Configure(const std::string& fileName)
     mGalilAxes[k] = 0;           // NULL termination
     mGalilQuery[q-1] = 0;        // NULL termination (and remove last comma)
 
-    // Default values should be read from JSON file
+    // Default values, unless specified (in SI units) in the parameters section of the JSON file
     mSpeedDefault.SetAll(0.025);   // 25 mm/s
     mAccelDefault.SetAll(0.256);   // 256 mm/s^2
     mDecelDefault.SetAll(0.256);   // 256 mm/s^2
+    for (size_t p = 0; p < m_configuration.parameters.size(); p++) {
+        const sawGalilControllerConfig::parameter &param = m_configuration.parameters[p];
+        if (param.values.size() != mNumAxes) {
+            CMN_LOG_CLASS_INIT_ERROR << "Configure: parameter " << param.name << " has " << param.values.size()
+                                     << " values, expected " << mNumAxes << " (ignored)" << std::endl;
+            continue;
+        }
+        if (!param.scale_to_bits)
+            continue;
+        if (param.name == "SP")
+            mSpeedDefault.Assign(param.values.data());
+        else if (param.name == "AC")
+            mAccelDefault.Assign(param.values.data());
+        else if (param.name == "DC")
+            mDecelDefault.Assign(param.values.data());
+    }
+
+    // Telemetry shared memory (optional)
+    if (!m_configuration.telemetry_shm.empty()) {
+        std::string error;
+        if (mTelemetry->Open(m_configuration.telemetry_shm, this->GetName(), mNumAxes,
+                             m_configuration.telemetry_history, error))
+            CMN_LOG_CLASS_INIT_VERBOSE << "Configure: telemetry in shared memory "
+                                       << m_configuration.telemetry_shm << std::endl;
+        else
+            CMN_LOG_CLASS_INIT_ERROR << "Configure: " << error << ", continuing without telemetry" << std::endl;
+    }
 
     // Call SetupInterfaces after Configure because we need to know the correct sizes of
     // the dynamic vectors, which are based on the number of configured axes.
@@ -388,54 +1212,581 @@ void mtsGalilController::Configure(const std::string& fileName)
 
 void mtsGalilController::Startup()
 {
-    std::string GalilString = m_configuration.IP_address;
-    if (m_configuration.direct_mode) {
-        GalilString.append(" -d");
+    // Real-time profile, unless jitter is first measured without it
+    if (m_configuration.realtime.compare_samples == 0)
+        ApplyRealtime();
+    // Bring-up is done in the background, so that Startup does not block
+    StartBringUp();
+}
+
+void mtsGalilController::ApplyRealtime(void)
+{
+    const sawGalilControllerConfig::realtime &rt = m_configuration.realtime;
+    if ((rt.main.policy == "other") && rt.main.cpus.empty() && (rt.main.prefault_stack_kb == 0) &&
+        !rt.lock_memory && (rt.prefault_heap_kb == 0))
+        return;    // Nothing to apply
+    // Called from the component thread (Startup or Run)
+    std::string error;
+    if (!LockMemory(rt.lock_memory, rt.prefault_heap_kb, error))
+        ReportMessage(MSG_WARNING, this->GetName() + ": " + error);
+    if (!ApplyThreadSettings(rt.main, error))
+        ReportMessage(MSG_WARNING, this->GetName() + ": " + error + ", continuing with default settings");
+    mRealtimeApplied = true;
+    mDRLastProcess = 0.0;
+}
+
+void mtsGalilController::StartBringUp(void)
+{
+    mConnectionState = CONNECTION_STARTING;
+    mState = ST_IDLE;
+    mBringUpDone = false;
+    mBringUpOk = false;
+    mBringUpMotionOk = false;
+    mBringUpPhase = PHASE_CONNECT;
+    mBringUpPhaseReported = PHASE_NUM;
+    mBringUpMutex.Lock();
+    mBringUpMessages.clear();
+    mBringUpMutex.Unlock();
+    for (size_t p = 0; p < PHASE_NUM; p++)
+        mBringUpPhaseTimes[p] = 0.0;
+    mBringUpPhaseStart = osaGetTime();
+    m_op_state.SetState(prmOperatingState::DISABLED);
+    m_op_state.SetIsBusy(true);
+    mBringUpThread.Create<mtsGalilController, int>(this, &mtsGalilController::BringUpThreadRun,
+                                                   0, "GalilStart");
+}
+
+void *mtsGalilController::BringUpThreadRun(int)
+{
+    mBringUpThreadId = std::this_thread::get_id();
+    bool ok = Connect();
+    if (!ok)
+        Close();
+    mBringUpThreadId = std::thread::id();
+    SetBringUpPhase(PHASE_NUM);   // Record time of last phase
+    mBringUpOk = ok;
+    mBringUpDone = true;
+    return 0;
+}
+
+void mtsGalilController::GetStartupPhaseNames(std::vector<std::string> &names) const
+{
+    names.assign(BringUpPhaseNames, BringUpPhaseNames + PHASE_NUM);
+}
+
+void mtsGalilController::SetBringUpPhase(BringUpPhase phase)
+{
+    double now = osaGetTime();
+    int current = mBringUpPhase;
+    if (current < PHASE_NUM)
+        mBringUpPhaseTimes[current] += now - mBringUpPhaseStart;
+    mBringUpPhaseStart = now;
+    mBringUpPhase = phase;
+}
+
+void mtsGalilController::UpdateBringUp(void)
+{
+    // Report progress
+    int phase = mBringUpPhase;
+    if ((phase != mBringUpPhaseReported) && (phase < PHASE_NUM)) {
+        mBringUpPhaseReported = phase;
+        mStartupPhaseEvent(std::string(BringUpPhaseNames[phase]));
     }
-    GalilString.append(" -s DR");  // Subscribe to DR records
-    GReturn ret = GOpen(GalilString.c_str(), &mGalil);
-    if (ret != G_NO_ERROR) {
-        mInterface->SendError(this->GetName() + ": error opening " + m_configuration.IP_address);
-        CMN_LOG_CLASS_INIT_ERROR << "Galil GOpen: error opening " << m_configuration.IP_address
-                                 << ": " << ret << std::endl;
+    // Forward the messages queued by the bring-up thread so far, so that errors are reported
+    // even if the bring-up does not finish (e.g., blocked in GOpen)
+    mBringUpMutex.Lock();
+    for (size_t i = 0; i < mBringUpMessages.size(); i++) {
+        const BringUpMessage &msg = mBringUpMessages[i];
+        if (msg.level == MSG_ERROR)
+            mInterface->SendError(msg.text);
+        else if (msg.level == MSG_WARNING)
+            mInterface->SendWarning(msg.text);
+        else
+            mInterface->SendStatus(msg.text);
+    }
+    mBringUpMessages.clear();
+    mBringUpMutex.Unlock();
+    if (!mBringUpDone)
         return;
+
+    mBringUpThread.Wait();
+    double total = 0.0;
+    for (size_t p = 0; p < PHASE_NUM; p++) {
+        mStartupTimes[p] = mBringUpPhaseTimes[p];
+        total += mBringUpPhaseTimes[p];
+        CMN_LOG_CLASS_RUN_VERBOSE << "Startup: " << BringUpPhaseNames[p] << " took "
+                                  << mBringUpPhaseTimes[p] << " s" << std::endl;
+    }
+    m_op_state.SetIsBusy(false);
+    if (mBringUpOk) {
+        // State table data set up by the bring-up thread, which has now finished
+        if (!mWasConnected && mBringUpMotionOk) {
+            mSpeed = mSpeedDefault;
+            mAccel = mAccelDefault;
+            mDecel = mDecelDefault;
+        }
+        mDRWakeLatency.Reset();
+        mDRQueueDelay.Reset();
+        mConnectionState = CONNECTION_READY;
+        mDRPeriod = m_configuration.DR_period_ms;
+        mDRIdle = false;
+        mDRLastActivity = osaGetTime();
+        mDRRateLastTime = 0.0;
+        mWasConnected = true;
+        char buf[64];
+        sprintf(buf, ": controller ready (%.3lf s)", total);
+        mInterface->SendStatus(this->GetName() + buf);
+        mStartupPhaseEvent(std::string("ready"));
+        mConnectedEvent(true);
+    }
+    else {
+        mConnectionState = CONNECTION_DISCONNECTED;
+        m_op_state.SetState(prmOperatingState::FAULT);
+        mStartupPhaseEvent(std::string("failed"));
+        StartReconnect();
+    }
+}
+
+// Messages generated during bring-up (in the background thread) are queued and
+// sent by Run (UpdateBringUp) in its next cycle
+void mtsGalilController::ReportMessage(MessageLevel level, const std::string &text)
+{
+    if (IsBringUpThread()) {
+        BringUpMessage msg;
+        msg.level = level;
+        msg.text = text;
+        mBringUpMutex.Lock();
+        mBringUpMessages.push_back(msg);
+        mBringUpMutex.Unlock();
     }
+    else if (level == MSG_ERROR)
+        mInterface->SendError(text);
+    else if (level == MSG_WARNING)
+        mInterface->SendWarning(text);
+    else
+        mInterface->SendStatus(text);
+}
 
-    // Upload a DMC program file if available
-    const std::string & DMC_file = m_configuration.DMC_file;
-    if (!DMC_file.empty()) {
-        if (cmnPath::Exists(DMC_file)) {
-            CMN_LOG_CLASS_INIT_VERBOSE << "Startup: downloading " << DMC_file << " to Galil controller" << std::endl;
-            if (GProgramDownloadFile(mGalil, DMC_file.c_str(), 0) == G_NO_ERROR) {
-                SendCommand("XQ");  // Execute downloaded program
+void mtsGalilController::ReportRepeatedError(ErrorSource source, int code, const char *detail)
+{
+    // The error table is only used by Run; errors during bring-up are reported individually
+    if (IsBringUpThread()) {
+        ReportMessage(MSG_ERROR, FormatRunMessage("%s error %d%s%s", ErrorSourceNames[source], code,
+                                                  detail ? " sending " : "", detail ? detail : ""));
+        return;
+    }
+    double now = osaGetTime();
+    // Find entry for this source and code, else use an unused entry or, if none, the
+    // inactive entry that was reported least recently
+    ErrorEntry *entry = 0;
+    ErrorEntry *unused = 0;
+    for (size_t i = 0; i < ERROR_TABLE_SIZE; i++) {
+        ErrorEntry &e = mErrorTable[i];
+        if ((e.source == source) && (e.code == code)) {
+            entry = &e;
+            break;
+        }
+        if (e.active || (unused && (unused->source < 0)))
+            continue;
+        if (!unused || (e.source < 0) || (e.lastReport < unused->lastReport))
+            unused = &e;
+    }
+    if (!entry) {
+        if (!unused)
+            return;    // All entries active (not expected)
+        entry = unused;
+        entry->source = source;
+        entry->code = code;
+        entry->count = 0;
+        entry->active = false;
+    }
+    entry->count++;
+    if (entry->active) {
+        entry->countSinceReport++;
+    }
+    else {
+        // First occurrence: report immediately
+        entry->active = true;
+        entry->countSinceReport = 0;
+        entry->firstCount = entry->count;
+        entry->firstTime = now;
+        entry->lastReport = now;
+        mActiveErrors++;
+        ReportMessage(MSG_ERROR, FormatRunMessage("%s error %d%s%s", ErrorSourceNames[source], code,
+                                                  detail ? " sending " : "", detail ? detail : ""));
+    }
+    UpdateErrorCounters();
+}
+
+void mtsGalilController::ErrorRecovered(ErrorSource source)
+{
+    if (IsBringUpThread())
+        return;    // See ReportRepeatedError
+    double now = osaGetTime();
+    for (size_t i = 0; i < ERROR_TABLE_SIZE; i++) {
+        ErrorEntry &e = mErrorTable[i];
+        if (e.active && (e.source == source)) {
+            e.active = false;
+            mActiveErrors--;
+            ReportMessage(MSG_STATUS, FormatRunMessage("%s error %d recovered (%u occurrences in %.1lf s)",
+                                                       ErrorSourceNames[source], e.code,
+                                                       e.count - e.firstCount + 1, now - e.firstTime));
+            e.lastReport = now;
+        }
+    }
+    UpdateErrorCounters();
+}
+
+void mtsGalilController::UpdateErrorSummaries(double now)
+{
+    for (size_t i = 0; i < ERROR_TABLE_SIZE; i++) {
+        ErrorEntry &e = mErrorTable[i];
+        if (e.active && (e.countSinceReport > 0) &&
+            (now - e.lastReport >= m_configuration.error_summary_period_s)) {
+            ReportMessage(MSG_ERROR, FormatRunMessage("%s error %d repeated %u times in last %.1lf s",
+                                                      ErrorSourceNames[e.source], e.code,
+                                                      e.countSinceReport, now - e.lastReport));
+            e.countSinceReport = 0;
+            e.lastReport = now;
+        }
+    }
+}
+
+void mtsGalilController::UpdateErrorCounters(void)
+{
+    for (size_t i = 0; i < ERROR_TABLE_SIZE; i++) {
+        const ErrorEntry &e = mErrorTable[i];
+        mErrorCounters.sources[i] = e.source;
+        mErrorCounters.codes[i] = (e.source >= 0) ? e.code : 0;
+        mErrorCounters.counts[i] = (e.source >= 0) ? e.count : 0;
+        mErrorCounters.active[i] = e.active;
+    }
+}
+
+void mtsGalilController::GetErrorSourceNames(std::vector<std::string> &names) const
+{
+    names.assign(ErrorSourceNames, ErrorSourceNames + ERROR_SOURCE_NUM);
+}
+
+// Format a message, prefixed by the component name, into mRunMessage, which is reserved in
+// Init so that formatting messages from Run and the servo commands does not allocate memory
+// (sending them may, so the steady state does not send any messages). The bring-up
+// thread, which runs at the same time as Run, uses mBringUpText instead.
+const std::string &mtsGalilController::FormatRunMessage(const char *format, ...)
+{
+    char buf[RUN_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    std::string &message = IsBringUpThread() ? mBringUpText : mRunMessage;
+    message.assign(this->GetName());
+    message.append(": ");
+    message.append(buf);
+    return message;
+}
+
+bool mtsGalilController::CheckReady(const char *cmdName)
+{
+    if (mConnectionState == CONNECTION_READY)
+        return true;
+    mInterface->SendError(FormatRunMessage("%s rejected, controller %s", cmdName,
+                                           (mConnectionState == CONNECTION_STARTING) ? "is starting up"
+                                                                                     : "is not connected"));
+    return false;
+}
+
+// Resident dispatcher (see ScheduleCommand), appended to the DMC program and run in its own
+// thread. It waits for gdgo, then waits (AT) until TIME reaches gdtgt and executes the command
+// (gdcmd: 1 for BG, 2 for ST) on the axes in gdmsk (bit mask of Galil indexes).
+std::string mtsGalilController::GetDispatcherProgram(void) const
+{
+    unsigned int allMask = 0;
+    for (const char *axis = mGalilAxes; *axis; axis++)
+        allMask |= (1 << (*axis - 'A'));
+    char buf[32];
+    std::string code;
+    code.append("#GDSP\ngdgo=0\n#GDWT\nJP#GDWT,gdgo=0\n");
+    code.append("gddly=gdtgt-TIME\nJP#GDRUN,gddly<1\nAT0\nATgddly,1\n#GDRUN\n");
+    const char *cmds[2] = { "BG", "ST" };
+    for (int c = 0; c < 2; c++) {
+        // All configured axes at the same time, else one axis at a time
+        code.append((c == 0) ? "JP#GDST,gdcmd<>1\n" : "#GDST\nJP#GDDN,gdcmd<>2\n");
+        sprintf(buf, "JP#GDSA%d,gdmsk<>%u\n", c, allMask);
+        code.append(buf);
+        code.append(cmds[c]).append(mGalilAxes).append("\nJP#GDDN\n");
+        sprintf(buf, "#GDSA%d\n", c);
+        code.append(buf);
+        for (const char *axis = mGalilAxes; *axis; axis++) {
+            sprintf(buf, "IF(gdmsk&%u)\n%s%c\nENDIF\n", 1u << (*axis - 'A'), cmds[c], *axis);
+            code.append(buf);
+        }
+        if (c == 0)
+            code.append("JP#GDDN\n");
+    }
+    code.append("#GDDN\ngdact=TIME\ngdgo=0\nJP#GDWT\nEN\n");
+    return code;
+}
+
+// Preprocess (see GalilProgram) and download DMC program (and dispatcher) and execute it, unless
+// the controller already has the same program (same hash), in which case it is only executed if
+// not already running.
+bool mtsGalilController::DownloadProgram(void)
+{
+    const std::string &fileName = m_configuration.DMC_file;
+    const int dispatcherThread = m_configuration.dispatcher_thread;
+    GalilProgram program;
+    bool ok = true;
+    if (!fileName.empty()) {
+        if (!cmnPath::Exists(fileName)) {
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: DMC program file \""
+                                     << fileName << "\" not found" << std::endl;
+            return false;
+        }
+        ok = program.Load(fileName);
+    }
+    if (dispatcherThread > 0)
+        program.Append(GetDispatcherProgram());
+    if (ok && (mModel < NUM_MODELS))
+        ok = program.Check(ProgramMaxLineLength, ProgramMaxLines[mModel], ProgramMaxLabels[mModel]);
+    if (!ok) {
+        const std::vector<std::string> &errors = program.GetErrors();
+        for (size_t i = 0; i < errors.size(); i++) {
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: DMC program " << fileName << ": " << errors[i] << std::endl;
+            if (i < 4)
+                ReportMessage(MSG_ERROR, this->GetName() + ": DMC program error, " + errors[i]);
+        }
+        return false;
+    }
+    const std::string &programText = program.GetProgram();
+    int32_t hash = ProgramHash(programText);
+    char buf[256];
+    sprintf(buf, ": DMC program has %d lines, %d labels, %d bytes (%d bytes removed by preprocessing)",
+            static_cast<int>(program.NumLines()), static_cast<int>(program.NumLabels()),
+            static_cast<int>(programText.size()),
+            static_cast<int>(program.OriginalSize() - programText.size()));
+    ReportMessage(MSG_STATUS, this->GetName() + buf);
+
+    if (!m_configuration.DMC_force_download) {
+        // Fails if the variables do not exist (e.g., program never downloaded)
+        double values[4];
+        char *result;
+        sprintf(buf, "MG " DMC_HASH_VAR "," DMC_TIME_VAR ",_XQ0,_XQ%d", (dispatcherThread > 0) ? dispatcherThread : 0);
+        if ((GCmdT(mGalil, buf, mBuffer, G_SMALL_BUFFER, &result) == G_NO_ERROR)
+            && (ParseValues(result, values, 4) == 4) && (static_cast<int32_t>(values[0]) == hash)) {
+            // _XQn is -1 if thread n not running
+            bool isRunning = (fileName.empty() || (values[2] >= 0.0)) &&
+                             ((dispatcherThread <= 0) || (values[3] >= 0.0));
+            if (!fileName.empty() && (values[2] < 0.0)) {
+                SendGalilCommand("XQ");
+                ShadowInvalidateAll();
             }
-            else {
-                CMN_LOG_CLASS_INIT_ERROR << "Startup: error downloading DMC program file "
-                                         << DMC_file << std::endl;
+            if ((dispatcherThread > 0) && (values[3] < 0.0)) {
+                sprintf(buf, "XQ #GDSP,%d", dispatcherThread);
+                SendGalilCommand(buf);
+            }
+            sprintf(buf, ": DMC program already on controller, skipped download (saved %.3lf s)%s",
+                    values[1]*0.001, isRunning ? "" : ", restarted program");
+            ReportMessage(MSG_STATUS, this->GetName() + buf);
+            return true;
+        }
+    }
+
+    CMN_LOG_CLASS_INIT_VERBOSE << "Startup: downloading " << fileName << " to Galil controller" << std::endl;
+    double t0 = osaGetTime();
+    if (GProgramDownload(mGalil, programText.c_str(), 0) != G_NO_ERROR) {
+        CMN_LOG_CLASS_INIT_ERROR << "Startup: error downloading DMC program file "
+                                 << fileName << std::endl;
+        return false;
+    }
+    int downloadMs = static_cast<int>((osaGetTime() - t0)*1000.0);
+    // Store hash and download time, to skip the download next time
+    sprintf(buf, DMC_HASH_VAR "=%d;" DMC_TIME_VAR "=%d", hash, downloadMs);
+    SendGalilCommand(buf);
+    if (!fileName.empty())
+        SendGalilCommand("XQ");  // Execute downloaded program
+    if (dispatcherThread > 0) {
+        sprintf(buf, "XQ #GDSP,%d", dispatcherThread);
+        SendGalilCommand(buf);
+    }
+    // The program may have changed any of the cached parameters
+    ShadowInvalidateAll();
+    return true;
+}
+
+// Format value for Galil command, with at most 4 decimals and without trailing zeros
+static void FormatValue(char *buf, double value)
+{
+    sprintf(buf, "%.4lf", value);
+    char *p = buf + strlen(buf) - 1;
+    while (*p == '0')
+        *p-- = 0;
+    if (*p == '.')
+        *p = 0;
+}
+
+bool mtsGalilController::ApplyParameters(void)
+{
+    const std::vector<sawGalilControllerConfig::parameter> &params = m_configuration.parameters;
+    // Operand names (e.g., _KPA) and values (in controller units) of all parameters
+    std::vector<std::string> names;
+    std::vector<double> desired;
+    std::vector<size_t> paramIndex;     // Index of parameter for each value
+    std::vector<size_t> axisIndex;      // Axis for each value
+    for (size_t p = 0; p < params.size(); p++) {
+        if (params[p].values.size() != mNumAxes)
+            continue;    // See Configure
+        for (size_t i = 0; i < mNumAxes; i++) {
+            names.push_back("_" + params[p].name + static_cast<char>('A' + mAxisToGalilIndexMap[i]));
+            double value = params[p].values[i];
+            if (params[p].scale_to_bits)
+                value = std::round(value*mEncoderCountsPerUnit[i]);
+            desired.push_back(value);
+            paramIndex.push_back(p);
+            axisIndex.push_back(i);
+        }
+    }
+    if (names.empty())
+        return true;
+
+    vctDoubleVec actual;
+    if (!QueryVariables(names, actual)) {
+        ReportMessage(MSG_ERROR, this->GetName() + ": could not query parameters");
+        return false;
+    }
+
+    // Values that differ, for each parameter (in Galil index order)
+    std::vector<size_t> changed;
+    char line[VARIABLE_LINE_MAX+1];
+    size_t len = 0;
+    char value[32];
+    BeginBatch();
+    size_t k = 0;
+    while (k < names.size()) {
+        size_t p = paramIndex[k];
+        std::string fields[GALIL_MAX_AXES];
+        unsigned int numFields = 0;
+        for (; (k < names.size()) && (paramIndex[k] == p); k++) {
+            // Same resolution as the controller (4 decimals)
+            if (std::fabs(actual[k] - desired[k]) < 0.5e-4)
+                continue;
+            unsigned int galilIndex = mAxisToGalilIndexMap[axisIndex[k]];
+            FormatValue(value, desired[k]);
+            fields[galilIndex] = value;
+            if (galilIndex+1 > numFields)
+                numFields = galilIndex+1;
+            changed.push_back(k);
+        }
+        if (numFields == 0)
+            continue;
+        // For example, "KP 6,,6"
+        std::string cmd = params[p].name + " ";
+        for (unsigned int g = 0; g < numFields; g++) {
+            if (g > 0)
+                cmd.append(",");
+            cmd.append(fields[g]);
+        }
+        // Several commands per line, separated by semicolons (see BatchJoinedCommand)
+        BatchJoinedCommand(line, len, cmd.c_str());
+    }
+    if (len > 0)
+        SendGalilCommand(line);
+    bool ok = EndBatch();
+
+    // Check the values that were sent
+    std::vector<bool> valid(names.size(), true);
+    if (!changed.empty()) {
+        std::vector<std::string> changedNames;
+        for (size_t c = 0; c < changed.size(); c++)
+            changedNames.push_back(names[changed[c]]);
+        vctDoubleVec readBack;
+        if (QueryVariables(changedNames, readBack)) {
+            for (size_t c = 0; c < changed.size(); c++) {
+                size_t j = changed[c];
+                double tolerance = std::max(0.5e-4, 1.0e-3*std::fabs(desired[j]));
+                if (std::fabs(readBack[c] - desired[j]) > tolerance) {
+                    FormatValue(value, readBack[c]);
+                    ReportMessage(MSG_WARNING, this->GetName() + ": parameter " + names[j]
+                                  + " is " + value + " after setting it");
+                    valid[j] = false;
+                    ok = false;
+                }
             }
         }
         else {
-            CMN_LOG_CLASS_INIT_ERROR << "Startup: DMC program file \""
-                                     << DMC_file << "\" not found" << std::endl;
+            valid.assign(names.size(), false);
+            ok = false;
         }
     }
 
-    // Set default speed, accel, decel
-    SetSpeed(mSpeedDefault);
-    SetAccel(mAccelDefault);
-    SetDecel(mDecelDefault);
+    // Update the shadow registers (see SendCmdValues), so that default values are not sent again
+    for (size_t j = 0; j < names.size(); j++) {
+        const std::string &name = params[paramIndex[j]].name;
+        ShadowParam shadow = (name == "SP") ? SHADOW_SP : (name == "AC") ? SHADOW_AC :
+                             (name == "DC") ? SHADOW_DC : (name == "LD") ? SHADOW_LD : SHADOW_NONE;
+        if ((shadow != SHADOW_NONE) && valid[j]) {
+            unsigned int galilIndex = mAxisToGalilIndexMap[axisIndex[j]];
+            mShadow[shadow].value[galilIndex] = static_cast<int32_t>(desired[j]);
+            mShadow[shadow].valid[galilIndex] = true;
+        }
+    }
 
-    // Store the current setting of limit disable (LD) in mLimitDisable
-    mLimitDisable.SetAll(0);
-    if (!QueryCmdValues("LD ", mGalilQuery, mLimitDisable))
-        CMN_LOG_CLASS_INIT_ERROR << "Startup: Could not query limit disable (LD)" << std::endl;
-    // Update mHomeLimitDisable based on mLimitDisable
-    for (size_t i = 0; i < mNumAxes; i++)
-        mHomeLimitDisable[i] |= mLimitDisable[i];
+    char buf[128];
+    sprintf(buf, ": parameters applied, %d values checked, %d changed",
+            static_cast<int>(names.size()), static_cast<int>(changed.size()));
+    ReportMessage(ok ? MSG_STATUS : MSG_WARNING, this->GetName() + buf);
+    return ok;
+}
+
+// Send speed, accel and decel in one batch (used during bring-up)
+bool mtsGalilController::SendMotionParameters(const vctDoubleVec &spd, const vctDoubleVec &accel,
+                                              const vctDoubleVec &decel)
+{
+    // mSpeed, mAccel and mDecel are in the state table, so they are not set by the
+    // bring-up thread (see UpdateBringUp)
+    const bool update = !IsBringUpThread();
+    BeginBatch();
+    if (galil_cmd_common("SetSpeed", "SP ", spd, false, SHADOW_SP) && update)
+        mSpeed = spd;
+    if (galil_cmd_common("SetAccel", "AC ", accel, false, SHADOW_AC) && update)
+        mAccel = accel;
+    if (galil_cmd_common("SetDecel", "DC ", decel, false, SHADOW_DC) && update)
+        mDecel = decel;
+    return EndBatch();
+}
+
+// Open the connections and bring up the controller (also used to reconnect)
+bool mtsGalilController::Connect(void)
+{
+    // Model detection is repeated on each connection
+    mModel = GetModelIndex(m_configuration.model);
+    mDRErrors = 0;
+
+    // New connection, so nothing is known about the controller state
+    ShadowInvalidateAll();
+    mJogActive = false;
+
+    // Connection for commands (no unsolicited data)
+    if (!OpenConnection(&mGalil, 0, "commands"))
+        return false;
+
+    // Optional pipelined command channel (raw TCP), used for command batches
+    if (m_configuration.command_pipeline_depth > 0) {
+        if (mPipeline->Open(m_configuration.IP_address.c_str(), m_configuration.command_pipeline_depth, 1000)) {
+            CMN_LOG_CLASS_INIT_VERBOSE << "Startup: opened pipelined command channel, depth = "
+                                       << m_configuration.command_pipeline_depth << std::endl;
+        }
+        else {
+            CMN_LOG_CLASS_INIT_WARNING << "Startup: could not open pipelined command channel to "
+                                       << m_configuration.IP_address
+                                       << ", sending commands one at a time" << std::endl;
+        }
+    }
 
     // Get controller type (^R^V)
+    SetBringUpPhase(PHASE_MODEL);
     if (GCmdT(mGalil, "\x12\x16", mBuffer, G_SMALL_BUFFER, 0) == G_NO_ERROR) {
-        mInterface->SendStatus("Galil Controller Revision: " + std::string(mBuffer));
+        ReportMessage(MSG_STATUS, "Galil Controller Revision: " + std::string(mBuffer));
         unsigned int autoModel = 0;   // detected model type
         const char *ptr = strstr(mBuffer, "DMC");
         if (ptr) {
@@ -455,12 +1806,12 @@ void mtsGalilController::Startup()
         }
         if (mModel >= NUM_MODELS) {
             if (autoModel == 0) {
-                mInterface->SendError(this->GetName() + ": could not detect model type");
+                ReportMessage(MSG_ERROR, this->GetName() + ": could not detect model type");
                 CMN_LOG_CLASS_INIT_ERROR << "Startup: Could not detect controller model, "
                                          << "please specify in JSON file" << std::endl;
                 // Close connection so we do not hang waiting for data
                 Close();
-                return;
+                return false;
             }
             mModel = GetModelIndex(autoModel);
             if (mModel < NUM_MODELS) {
@@ -468,27 +1819,242 @@ void mtsGalilController::Startup()
                                            << " (index = " << mModel << ")" << std::endl;
             }
             else {
-                mInterface->SendError(this->GetName() + ": invalid model type");
+                ReportMessage(MSG_ERROR, this->GetName() + ": invalid model type");
                 // Close connection so we do not hang waiting for data
                 Close();
-                return;
+                return false;
             }
         }
         else if ((autoModel != 0) && (GetModelIndex(autoModel) != mModel)) {
-            mInterface->SendWarning(this->GetName() + ": controller model mismatch (see log file)");
+            ReportMessage(MSG_WARNING, this->GetName() + ": controller model mismatch (see log file)");
             CMN_LOG_CLASS_INIT_WARNING << "Startup: detected controller model " << autoModel
                                        << " differs from value specified in JSON file "
                                        << ModelTypes[mModel] << std::endl;
         }
     }
 
-    ret = GRecordRate(mGalil, m_configuration.DR_period_ms);
-    if (ret != G_NO_ERROR) {
-        CMN_LOG_CLASS_INIT_ERROR << "Galil GRecordRate: error " << ret << " setting rate to "
+    // Sample period (TM, in usec), e.g., for ScheduleCommand
+    double tm;
+    char *tmResult;
+    if ((GCmdT(mGalil, "MG _TM", mBuffer, G_SMALL_BUFFER, &tmResult) == G_NO_ERROR) &&
+        (ParseValues(tmResult, &tm, 1) == 1) && (tm > 0.0))
+        mSamplePeriod = tm*1.0e-6;
+    // The controller may have been reset, so restart the clock synchronization
+    mClock->Reset();
+    mClock->SetNominalPeriod(mSamplePeriod);
+
+    // Download a DMC program file if available
+    SetBringUpPhase(PHASE_DOWNLOAD);
+    if (!m_configuration.DMC_file.empty() || (m_configuration.dispatcher_thread > 0))
+        DownloadProgram();
+
+    SetBringUpPhase(PHASE_PARAMETERS);
+    ApplyParameters();
+    if (!mWasConnected) {
+        // Set default speed, accel, decel (copied to mSpeed, mAccel and mDecel by UpdateBringUp)
+        mBringUpMotionOk = SendMotionParameters(mSpeedDefault, mAccelDefault, mDecelDefault);
+        if (!mBringUpMotionOk)
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: failed to set default speed, accel and decel" << std::endl;
+
+        // Store the current setting of limit disable (LD) in mLimitDisable
+        mLimitDisable.SetAll(0);
+        if (QueryCmdValues("LD ", mGalilQuery, mLimitDisable)) {
+            for (size_t i = 0; i < mNumAxes; i++) {
+                unsigned int galilIndex = mAxisToGalilIndexMap[i];
+                mShadow[SHADOW_LD].value[galilIndex] = mLimitDisable[i];
+                mShadow[SHADOW_LD].valid[galilIndex] = true;
+            }
+        }
+        else
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: Could not query limit disable (LD)" << std::endl;
+        // Update mHomeLimitDisable based on mLimitDisable
+        for (size_t i = 0; i < mNumAxes; i++)
+            mHomeLimitDisable[i] |= mLimitDisable[i];
+    }
+    else {
+        // Reconnecting (controller may have been reset), so restore previous settings
+        if (!SendMotionParameters(mSpeed, mAccel, mDecel))
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: failed to restore speed, accel and decel" << std::endl;
+        if (!galil_cmd_common("Startup (LD)", "LD ", mLimitDisable, SHADOW_LD))
+            CMN_LOG_CLASS_INIT_ERROR << "Startup: failed to restore limit disable (LD)" << std::endl;
+    }
+
+    // Connection for stop commands, used from the caller's thread (see RequestStop)
+    SetBringUpPhase(PHASE_HELPERS);
+    void *galilStop;
+    if (OpenConnection(&galilStop, 0, "stop commands")) {
+        mStopMutex.Lock();
+        mGalilStop = galilStop;
+        WriteCmdAxes(mStopCmdST, "ST ", mGalilAxes);
+        WriteCmdAxes(mStopCmdMO, "MO ", mGalilAxes);
+        mStopMutex.Unlock();
+    }
+
+    // Connection for unsolicited messages (MG), serviced by its own thread
+    if (OpenConnection(&mGalilMsg, "-s MG", "messages")) {
+        GTimeout(mGalilMsg, 100);   // So that the thread can be stopped
+        mMessageThreadRunning = true;
+        mMessageThread.Create<mtsGalilController, int>(this, &mtsGalilController::MessageThreadRun,
+                                                       0, "GalilMsg");
+    }
+
+    // Connection for interrupts (EI), serviced by its own thread
+    if (m_configuration.interrupts && OpenConnection(&mGalilEI, "-s EI", "interrupts")) {
+        GTimeout(mGalilEI, 100);    // So that the thread can be stopped
+        // Enable interrupts for motion complete on the configured axes, limit switches
+        // and, if specified, digital inputs
+        unsigned int mask = EI_MaskLimitSwitch;
+        for (unsigned int i = 0; i < mGalilIndexMax; i++) {
+            if (mGalilIndexValid[i])
+                mask |= (1 << i);
+        }
+        if (m_configuration.interrupt_inputs)
+            mask |= EI_MaskInputs;
+        sprintf(mBuffer, "EI %u,%u", mask, m_configuration.interrupt_inputs);
+        if (SendGalilCommand(mBuffer)) {
+            mInterruptThreadRunning = true;
+            mInterruptThread.Create<mtsGalilController, int>(this, &mtsGalilController::InterruptThreadRun,
+                                                             0, "GalilEI");
+        }
+        else {
+            CMN_LOG_CLASS_INIT_WARNING << "Startup: could not enable interrupts (" << mBuffer
+                                       << "), motion complete will only be detected from DR" << std::endl;
+            GClose(mGalilEI);
+            mGalilEI = 0;
+        }
+    }
+
+    // Connection subscribed to DR only, read by Run
+    SetBringUpPhase(PHASE_DATA_RECORD);
+    if (m_configuration.DR_kernel_timestamps) {
+        // Own UDP socket, so that the kernel receive time is available
+        if (mDRSocket->Open(m_configuration.IP_address.c_str(), 1000)) {
+            CMN_LOG_CLASS_INIT_VERBOSE << "Startup: receiving DR on handle IH" << mDRSocket->Handle()
+                                       << (mDRSocket->HasKernelTimestamps() ? ", with" : ", without")
+                                       << " kernel timestamps" << std::endl;
+        }
+        else {
+            CMN_LOG_CLASS_INIT_WARNING << "Startup: could not open DR socket to "
+                                       << m_configuration.IP_address << ", using gclib" << std::endl;
+        }
+    }
+    if (!mDRSocket->IsOpen() && !OpenConnection(&mGalilDR, "-s DR", "data records")) {
+        Close();
+        return false;
+    }
+    // Homed flag is not in DR for some models, so query it (at low rate) instead
+    if ((mQueries.size() > 0) && (mQueries[0].row < 0))
+        mQueries.erase(mQueries.begin());
+    if (AxisDataSize[mModel] != ADmax) {
+        ScheduledQuery query;
+        query.command = "MG ";
+        for (const char *axis = mGalilAxes; *axis; axis++) {
+            if (axis != mGalilAxes)
+                query.command.append(",");
+            query.command.append("_ZA");
+            query.command.append(1, *axis);
+        }
+        query.period = 0.2;
+        query.nextTime = 0.0;
+        query.cost = 0.0;
+        query.overBudget = false;
+        query.row = -1;
+        mQueries.insert(mQueries.begin(), query);
+    }
+    mQueryNext = 0;
+
+    if (!SetRecordRate(m_configuration.DR_period_ms)) {
+        CMN_LOG_CLASS_INIT_ERROR << "Startup: error setting DR rate to "
                                  << m_configuration.DR_period_ms << " ms" << std::endl;
         // Close connection so we do not hang waiting for data
         Close();
+        return false;
+    }
+    // Handle of the DR connection, for setting the DR rate on the command connection
+    mDRHandle = -1;
+    if (mDRSocket->IsOpen())
+        mDRHandle = mDRSocket->Handle() - 'A';
+    else {
+        // WH returns the handle name, e.g., "IHC"
+        char *result;
+        if ((GCmdT(mGalilDR, "WH", mBuffer, G_SMALL_BUFFER, &result) == G_NO_ERROR) &&
+            (strncmp(result, "IH", 2) == 0) && (result[2] >= 'A') && (result[2] <= 'P'))
+            mDRHandle = result[2] - 'A';
+    }
+    StartDRThread();
+    return true;
+}
+
+void mtsGalilController::ConnectionLost(void)
+{
+    mInterface->SendError(this->GetName() + ": lost connection to " + m_configuration.IP_address);
+    ServoMailboxDiscard();
+    mJogActive = false;
+    mMotionActive = false;
+    mMotorPowerOn = false;
+    m_op_state.SetState(prmOperatingState::FAULT);
+    m_op_state.SetIsBusy(false);
+    Close();
+    mConnectionState = CONNECTION_DISCONNECTED;
+    mConnectedEvent(false);
+    StartReconnect();
+}
+
+void mtsGalilController::Reconnect(void)
+{
+    StopReconnect();
+    mInterface->SendStatus(this->GetName() + ": reconnecting to " + m_configuration.IP_address);
+    StartBringUp();
+}
+
+void mtsGalilController::StartReconnect(void)
+{
+    if (!m_configuration.reconnect || mReconnectThreadRunning)
+        return;
+    mReconnectReady = false;
+    mReconnectThreadRunning = true;
+    mReconnectThread.Create<mtsGalilController, int>(this, &mtsGalilController::ReconnectThreadRun,
+                                                     0, "GalilReconn");
+}
+
+void mtsGalilController::StopReconnect(void)
+{
+    if (mReconnectThreadRunning) {
+        mReconnectThreadRunning = false;
+        mReconnectThread.Wait();
+    }
+    mReconnectReady = false;
+}
+
+// Periodically checks (with exponential backoff) whether the controller can be reached.
+// Run then starts the bring-up (see Reconnect).
+void *mtsGalilController::ReconnectThreadRun(int)
+{
+    std::string GalilString = m_configuration.IP_address;
+    if (m_configuration.direct_mode)
+        GalilString.append(" -d");
+    double delay = m_configuration.reconnect_min_s;
+    while (mReconnectThreadRunning) {
+        // Wait in short steps, so that the thread can be stopped
+        double wakeTime = osaGetTime() + delay;
+        while (mReconnectThreadRunning && (osaGetTime() < wakeTime))
+            osaSleep(0.05);
+        if (!mReconnectThreadRunning)
+            break;
+        GCon probe = 0;
+        GReturn ret = GOpen(GalilString.c_str(), &probe);
+        if (ret == G_NO_ERROR) {
+            GClose(probe);
+            mReconnectReady = true;
+            break;
+        }
+        CMN_LOG_CLASS_RUN_VERBOSE << "ReconnectThreadRun: could not open " << m_configuration.IP_address
+                                  << " (" << ret << "), next attempt in " << delay << " s" << std::endl;
+        delay *= 2.0;
+        if (delay > m_configuration.reconnect_max_s)
+            delay = m_configuration.reconnect_max_s;
     }
+    return 0;
 }
 
 void mtsGalilController::Run()
@@ -497,9 +2063,70 @@ void mtsGalilController::Run()
     GReturn ret;
 
     // Get the Galil data record (DR) and parse it
-    if (mGalil) {
-        ret = GRecord(mGalil, &gRec, G_DR);
-        if (ret == G_NO_ERROR) {
+    if (mConnectionState == CONNECTION_READY) {
+        // The DR is read by the DR thread (see DRThreadRun). Wait for the next one, or for a
+        // queued command, but at most DR_max_wait_ms (e.g., if the DR stalls).
+        const DataRecordSlot *slot = mDRQueue.GetReadSlot();
+        if (!slot) {
+            mRunSignal.Wait(m_configuration.DR_max_wait_ms*1.0e-3);
+            slot = mDRQueue.GetReadSlot();
+        }
+        // Host receive times (CLOCK_MONOTONIC): kernel time is only available with DR socket
+        double kernelTime = 0.0, userTime = 0.0;
+        ret = G_NO_ERROR;
+        if (slot) {
+            ret = slot->ret;
+            kernelTime = slot->kernelTime;
+            userTime = slot->userTime;
+            memcpy(&gRec, slot->data, sizeof(gRec));
+            mDRQueue.Pop();
+        }
+        mDRDropped = mDRDroppedCount;
+        if (slot && (ret == G_NO_ERROR)) {
+            mDRErrors = 0;
+            if (mActiveErrors > 0)
+                ErrorRecovered(ERROR_SOURCE_DR);
+            // Processing time, read from both clocks at the same instant, so that the
+            // receive times (CLOCK_MONOTONIC, from the DR thread) can be converted to the
+            // time base of the state table
+            double now = osaGetTime();
+            const double relativeNow = mtsManagerLocal::GetInstance()->GetTimeServer().GetRelativeTime();
+            const double processTime = HostMonotonicTime();
+            const double toRelative = relativeNow - processTime;
+            // Time spent in the queue from the DR thread
+            mDRQueueDelay.Update(processTime - userTime);
+            // Inter-arrival time, to monitor DR jitter
+            // (only at the fast rate, so that the statistics are not affected by the idle rate)
+            if ((mDRLastArrival > 0.0) && !mDRIdle)
+                mDRStatistics.Update(kernelTime - mDRLastArrival);
+            mDRLastArrival = kernelTime;
+            // Deviation of the processing period from the DR period, before and after
+            // applying the real-time profile
+            const double lastProcess = mDRLastProcess;
+            mDRLastProcess = processTime;
+            if (lastProcess > 0.0) {
+                if (mDRIdle)
+                    mPeriodIdle.Update(processTime - lastProcess);
+                else
+                    mPeriodActive.Update(processTime - lastProcess);
+            }
+            if ((lastProcess > 0.0) && !mDRIdle && (mDRPeriod > 0)) {
+                double jitter = std::fabs((processTime - lastProcess) - mDRPeriod*1.0e-3);
+                if (mRealtimeApplied)
+                    mJitterAfter.Update(jitter);
+                else {
+                    mJitterBefore.Update(jitter);
+                    if ((m_configuration.realtime.compare_samples > 0) &&
+                        (mJitterBefore.number_of_samples >= m_configuration.realtime.compare_samples))
+                        ApplyRealtime();
+                }
+            }
+            // Time from kernel receive to processing (scheduler latency)
+            if (mDRSocket->HasKernelTimestamps())
+                mDRWakeLatency.Update(processTime - kernelTime);
+            // Receive and processing times in the time base of the state table
+            mDRTimes[0] = kernelTime + toRelative;
+            mDRTimes[1] = relativeNow;
             // First 4 bytes are header (for most controllers)
             if (HasHeader[mModel])
                 mHeader = *reinterpret_cast<uint32_t *>(gRec.byte_array);
@@ -527,8 +2154,15 @@ void mtsGalilController::Run()
                 mStopCode[i] = axisPtr->stop_code;    // See Galil SC command
                 mSwitches[i] = axisPtr->switches;     // See Galil User Manual
                 mAnalogIn[i] = axisPtr->analog_in;
-                if (mAxisStatus[i] & StatusMotorMoving)
+                bool isMoving = (mAxisStatus[i] & StatusMotorMoving);
+                if (isMoving)
                     isAnyMoving = true;
+                else if (mAxisWasMoving[i]) {
+                    // Motion complete detected from DR
+                    mMotionCompleteTimeDR[i] = now;
+                    UpdateInterruptLatency(i);
+                }
+                mAxisWasMoving[i] = isMoving;
                 if (mAxisStatus[i] & StatusMotorOff)
                     isAllMotorOn = false;
                 else
@@ -560,47 +2194,135 @@ void mtsGalilController::Run()
                     mActuatorState.IsHomed()[i] = reinterpret_cast<AxisDataMax *>(axisPtr)->var;
                 }
                 else {
-                    // Probably look at a cached version of IsHomed
+                    // Not in DR for this model, so use the value from the homed query
+                    mActuatorState.IsHomed()[i] = mIsHomed[i];
                 }
             }
             // TODO: check following logic
             mActuatorState.SetEStopON(mAmpStatus & (AmpEloUpper | AmpEloLower));
-            // TODO: previous implementation used TIME (i.e., "MG TIME"); do we need that, or
-            // is it sufficient to use mSampleNum, perhaps scaled by the DR period
-            mActuatorState.SetTimestamp(mSampleNum);
+            // Timestamp with the estimated host time of the sample, converted to the time
+            // base of the state table
+            int64_t sample = mClock->Update(mSampleNum, kernelTime);
+            double sampleTime = mClock->HostTime(sample) + toRelative;
+            m_measured_js.SetTimestamp(sampleTime);
+            m_setpoint_js.SetTimestamp(sampleTime);
+            mActuatorState.SetTimestamp(sampleTime);
+            mClockSync.valid = mClock->IsValid();
+            mClockSync.sample = static_cast<double>(sample);
+            mClockSync.offset = mClock->Offset();
+            mClockSync.drift_ppm = mClock->Drift()*1.0e6;
+            mClockSync.jitter = mClock->Jitter();
 
             if (!isAllMotorOn && !isAllMotorOff) {
                 // If a mix of on/off motors, turn them all off
-                mInterface->SendWarning(this->GetName() + ": inconsistent motor power (turning off)");
+                mInterface->SendWarning(FormatRunMessage("inconsistent motor power (turning off)"));
                 DisableMotorPower();
                 isAllMotorOn = false;
                 isAllMotorOff = true;
             }
+            // Jog (servo_jv) ends when the axes stop, e.g., due to a limit switch.
+            // Wait a few samples after BG so that the motion has time to start.
+            if (mJogActive) {
+                if (mJogSettleCycles > 0)
+                    mJogSettleCycles--;
+                else if (!isAnyMoving)
+                    mJogActive = false;
+            }
+            if (mSchedulePending)
+                UpdateScheduleSkew();
+            if (isAnyMoving)
+                mDRLastActivity = now;
+            UpdateDRRate(now);
             mMotionActive = isAnyMoving;
             mMotorPowerOn = isAllMotorOn;
             m_op_state.SetState(mMotorPowerOn ? prmOperatingState::ENABLED : prmOperatingState::DISABLED);
             m_op_state.SetIsBusy(mMotionActive);
+            UpdateSnapshot(sample, sampleTime, mDRTimes[0]);
+            UpdateHistory(sample, sampleTime);
+            if (mTelemetry->IsOpen())
+                UpdateTelemetry(sample, mClock->HostTime(sample), kernelTime);
         }
-        else {
+        else if (slot) {
             mMotionActive = false;
             mMotorPowerOn = false;
             m_op_state.SetState(prmOperatingState::FAULT);
             m_op_state.SetIsBusy(false);
-            char buf[128];
-            sprintf(buf, ": GRecord error %d", ret);
-            mInterface->SendError(this->GetName() + buf);
+            mSnapshot.valid = false;
+            ReportRepeatedError(ERROR_SOURCE_DR, ret);
+            if (++mDRErrors >= DR_ERRORS_DISCONNECT)
+                ConnectionLost();
         }
     }
+    else if (mConnectionState == CONNECTION_STARTING) {
+        // Bring-up in progress (see StartBringUp)
+        UpdateBringUp();
+        osaSleep(DISCONNECTED_PERIOD);
+    }
+    else if (mReconnectReady) {
+        // Controller can be reached again
+        Reconnect();
+    }
+    else {
+        // Not connected, so do not spin (there is no DR to wait for)
+        osaSleep(DISCONNECTED_PERIOD);
+    }
 
     // Advance the state table now, so that any connected components can get
     // the latest data.
     StateTable.Advance();
 
+    if (mSnapshotNew) {
+        if (m_configuration.snapshot_event)
+            mSnapshotEvent(mSnapshot);
+        mSnapshotNew = false;
+    }
+
     // Call any connected components
     RunEvent();
 
+    // Complete stop commands (see RequestStop). Motion commands processed in the same cycle
+    // are discarded, i.e., those queued before the stop and also those queued after the
+    // stop returned but before this cycle (the mailboxes do not record when each command
+    // was queued).
+    unsigned int stop = mStopRequest.exchange(0);
+    if (stop)
+        HandleStop(stop, mStopSent.exchange(0));
+    const double *latency;
+    while ((latency = mStopLatencyQueue.GetReadSlot()) != 0) {
+        mStopLatency.Update(*latency);
+        mStopLatencyQueue.Pop();
+    }
+
     ProcessQueuedCommands();
 
+    if (mDiscardMotion) {
+        if (mMotionDiscarded > 0)
+            mInterface->SendWarning(FormatRunMessage("discarded %u queued motion commands after stop",
+                                                     mMotionDiscarded));
+        mMotionDiscardedTotal += mMotionDiscarded;
+        mMotionDiscarded = 0;
+        mDiscardMotion = false;
+    }
+
+    // Forward messages and interrupts received from the controller
+    ProcessMessages();
+    ProcessInterrupts();
+
+    // The rest uses the connection and the state that Connect sets, so it is skipped
+    // during bring-up (the commands above are rejected, see CheckReady)
+    if (mConnectionState != CONNECTION_READY)
+        return;
+
+    // Send the most recent servo goal (if any) received since the last cycle
+    ServoMailboxSend();
+
+    // Low-rate queries, if any are due
+    RunQueries();
+
+    // Summaries of repeated errors
+    if (mActiveErrors > 0)
+        UpdateErrorSummaries(osaGetTime());
+
     switch (mState) {
 
     case ST_IDLE:
@@ -609,7 +2331,7 @@ void mtsGalilController::Run()
     case ST_HOMING:
         if (mStopCode.Equal(SC_Homing)) {
             SetHomePosition(mHomePos);
-            if (!galil_cmd_common("home (LD-restore)", "LD ", mLimitDisable))
+            if (!galil_cmd_common("home (LD-restore)", "LD ", mLimitDisable, SHADOW_LD))
                mInterface->SendError("Home: failed to restore limits");
             mInterface->SendStatus(this->GetName() + ": finished homing");
             mState = ST_IDLE;
@@ -618,7 +2340,121 @@ void mtsGalilController::Run()
     }
 }
 
+// Copy the state from the current DR (sizes were set in Configure, so there is no allocation)
+void mtsGalilController::UpdateSnapshot(int64_t sample, double sampleTime, double receiveTime)
+{
+    mSnapshot.valid = true;
+    mSnapshot.sample = static_cast<double>(sample);
+    mSnapshot.sample_time = sampleTime;
+    mSnapshot.receive_time = receiveTime;
+    mSnapshot.error_code = mErrorCode;
+    mSnapshot.amp_status = mAmpStatus;
+    mSnapshot.motor_power_on = mMotorPowerOn;
+    mSnapshot.moving = mMotionActive;
+    mSnapshot.measured_position.Assign(m_measured_js.Position());
+    mSnapshot.measured_velocity.Assign(m_measured_js.Velocity());
+    mSnapshot.setpoint_position.Assign(m_setpoint_js.Position());
+    mSnapshot.setpoint_effort.Assign(m_setpoint_js.Effort());
+    mSnapshot.axis_status.Assign(mAxisStatus);
+    mSnapshot.stop_code.Assign(mStopCode);
+    mSnapshot.switches.Assign(mSwitches);
+    mSnapshot.analog_in.Assign(mAnalogIn);
+    mSnapshotNew = true;
+}
+
+void mtsGalilController::UpdateHistory(int64_t sample, double sampleTime)
+{
+    HistoryEntry &entry = mHistory[mHistoryHead % mHistory.size()];
+    entry.sample = sample;
+    entry.sampleTime = sampleTime;
+    for (size_t i = 0; i < mNumAxes; i++) {
+        entry.measuredPos[i] = m_measured_js.Position()[i];
+        entry.measuredVel[i] = m_measured_js.Velocity()[i];
+        entry.setpointPos[i] = m_setpoint_js.Position()[i];
+        entry.axisStatus[i] = mAxisStatus[i];
+        entry.stopCode[i] = mStopCode[i];
+    }
+    mHistoryHead++;
+}
+
+void mtsGalilController::UpdateTelemetry(int64_t sample, double hostSampleTime, double hostReceiveTime)
+{
+    GalilTelemetrySample &tel = mTelemetrySample;
+    tel.flags = (mMotorPowerOn ? GALIL_TELEMETRY_MOTOR_POWER_ON : 0u) |
+                (mMotionActive ? GALIL_TELEMETRY_MOVING : 0u);
+    tel.sample = sample;
+    tel.sample_time = hostSampleTime;
+    tel.receive_time = hostReceiveTime;
+    tel.error_code = mErrorCode;
+    tel.amp_status = mAmpStatus;
+    for (size_t i = 0; i < mNumAxes; i++) {
+        tel.measured_position[i] = m_measured_js.Position()[i];
+        tel.measured_velocity[i] = m_measured_js.Velocity()[i];
+        tel.setpoint_position[i] = m_setpoint_js.Position()[i];
+        tel.setpoint_effort[i] = m_setpoint_js.Effort()[i];
+        tel.axis_status[i] = mAxisStatus[i];
+        tel.analog_in[i] = mAnalogIn[i];
+        tel.stop_code[i] = mStopCode[i];
+        tel.switches[i] = mSwitches[i];
+    }
+    mTelemetry->Publish(tel);
+}
+
+void mtsGalilController::GetHistorySince(const GalilHistoryRequest &request, GalilHistory &history)
+{
+    const uint64_t size = mHistory.size();
+    const uint64_t head = mHistoryHead;
+    const uint64_t oldest = (head > size) ? head - size : 0;
+    const bool all = (request.sample < 0.0);
+    // Find the first entry after the requested sample, going back from the newest entry.
+    // The sample number restarts on reconnect: if the requested sample is after the newest
+    // one, or the sample numbers are not increasing, only entries after the restart are used.
+    uint64_t first = head;
+    history.overwritten = false;
+    if (head > oldest) {
+        const bool restart = !all && (mHistory[(head-1) % size].sample < request.sample);
+        first = head-1;
+        while ((first > oldest) &&
+               (mHistory[(first-1) % size].sample < mHistory[first % size].sample) &&
+               (all || restart || (mHistory[(first-1) % size].sample > request.sample)))
+            first--;
+        if (!all && !restart) {
+            if (mHistory[first % size].sample <= request.sample)
+                first++;
+            else if ((first == oldest) && (oldest > 0))
+                history.overwritten = true;   // Older entries are no longer available
+        }
+    }
+    size_t count = static_cast<size_t>(head - first);
+    if (count > request.max_count)
+        count = request.max_count;
+
+    // Copy in one pass, one row per entry
+    history.sample.SetSize(count);
+    history.sample_time.SetSize(count);
+    history.measured_position.SetSize(count, mNumAxes);
+    history.measured_velocity.SetSize(count, mNumAxes);
+    history.setpoint_position.SetSize(count, mNumAxes);
+    history.axis_status.SetSize(count, mNumAxes);
+    history.stop_code.SetSize(count, mNumAxes);
+    for (size_t row = 0; row < count; row++) {
+        const HistoryEntry &entry = mHistory[(first+row) % size];
+        history.sample[row] = static_cast<double>(entry.sample);
+        history.sample_time[row] = entry.sampleTime;
+        for (size_t i = 0; i < mNumAxes; i++) {
+            history.measured_position.Element(row, i) = entry.measuredPos[i];
+            history.measured_velocity.Element(row, i) = entry.measuredVel[i];
+            history.setpoint_position.Element(row, i) = entry.setpointPos[i];
+            history.axis_status.Element(row, i) = entry.axisStatus[i];
+            history.stop_code.Element(row, i) = entry.stopCode[i];
+        }
+    }
+}
+
 void mtsGalilController::Cleanup(){
+    if (mConnectionState == CONNECTION_STARTING)
+        mBringUpThread.Wait();
+    StopReconnect();
     Close();
 }
 
@@ -666,7 +2502,7 @@ bool mtsGalilController::QueryCmdValues(const char *cmd, const char *query, vctI
         for (size_t i = 0; i < data.size(); i++) {
             long value;
             if (sscanf(p, "%ld%n", &value, &nChars) != 1) {
-                mInterface->SendError(this->GetName() + " QueryCmdValues failed for " + recvBuffer);
+                ReportMessage(MSG_ERROR, this->GetName() + " QueryCmdValues failed for " + recvBuffer);
                 return false;
             }
             data[i] = value;
@@ -677,21 +2513,141 @@ bool mtsGalilController::QueryCmdValues(const char *cmd, const char *query, vctI
     return (ret == G_NO_ERROR);
 }
 
-void mtsGalilController::SendCommand(const std::string &cmdString)
+bool mtsGalilController::SendGalilCommand(const char *cmdString)
 {
-    if (mGalil) {
-        GReturn ret = GCmd(mGalil, cmdString.c_str());
-        if (ret != G_NO_ERROR) {
-            char buf[64];
-            sprintf(buf, "SendCommand: error %d sending ", ret);
-            mInterface->SendError(std::string(buf)+cmdString);
+    if (!mGalil)
+        return false;
+    if (mBatchActive) {
+        size_t len = strlen(cmdString)+1;
+        if (len > BATCH_BUFFER_SIZE)
+            return false;
+        // Send what we have so far if batch is full
+        if ((mBatchNum == BATCH_MAX_COMMANDS) || (mBatchUsed+len > BATCH_BUFFER_SIZE)) {
+            if (!FlushBatch())
+                return false;
+        }
+        char *cmd = mBatchBuffer + mBatchUsed;
+        memcpy(cmd, cmdString, len);
+        mBatchUsed += len;
+        mBatchCmds[mBatchNum++] = cmd;
+        return true;
+    }
+    double t0 = osaGetTime();
+    GReturn ret = GCmd(mGalil, cmdString);
+    if (ret != G_NO_ERROR) {
+        ReportRepeatedError(ERROR_SOURCE_COMMAND, ret, cmdString);
+        return false;
+    }
+    // Statistics and error table are only used by Run (see ReportRepeatedError)
+    if (!IsBringUpThread()) {
+        mCommandStatistics.Update(osaGetTime() - t0);
+        if (mActiveErrors > 0)
+            ErrorRecovered(ERROR_SOURCE_COMMAND);
+    }
+    return true;
+}
+
+void mtsGalilController::BeginBatch(void)
+{
+    mBatchActive = true;
+    mBatchUsed = 0;
+    mBatchNum = 0;
+}
+
+bool mtsGalilController::FlushBatch(void)
+{
+    size_t num = mBatchNum;
+    mBatchUsed = 0;
+    mBatchNum = 0;
+    if (num == 0)
+        return true;
+
+    bool ok = true;
+    if (mPipeline->IsOpen()) {
+        double t0 = osaGetTime();
+        int numFailed = mPipeline->SendBatch(mBatchCmds, num);
+        if (numFailed == 0) {
+            if (!IsBringUpThread()) {
+                mPipelineStatistics.Update((osaGetTime() - t0)/num);
+                if (mActiveErrors > 0)
+                    ErrorRecovered(ERROR_SOURCE_PIPELINE);
+            }
+        }
+        else if (numFailed < 0) {
+            ReportMessage(MSG_ERROR, FormatRunMessage("communication error on pipelined command channel, "
+                                                      "reverting to one command at a time"));
+            ok = false;
         }
+        else {
+            for (size_t i = 0; i < mPipeline->NumErrors(); i++) {
+                const GalilCommandPipeline::Error &err = mPipeline->GetError(i);
+                ReportRepeatedError(ERROR_SOURCE_PIPELINE, err.code, mBatchCmds[err.index]);
+            }
+            // The rest of the batch is not sent after a failed command
+            if (mPipeline->NumSent() < num)
+                ReportMessage(MSG_WARNING, FormatRunMessage("%u pipelined command lines not sent after failed command",
+                                                            static_cast<unsigned int>(num - mPipeline->NumSent())));
+            ok = false;
+        }
+    }
+    else {
+        // Send one at a time
+        mBatchActive = false;
+        for (size_t i = 0; i < num; i++) {
+            if (!SendGalilCommand(mBatchCmds[i]))
+                ok = false;
+        }
+        mBatchActive = true;
+    }
+    // Not sure what the controller has now (shadow registers were updated when queued)
+    if (!ok)
+        ShadowInvalidateAll();
+    return ok;
+}
+
+bool mtsGalilController::EndBatch(void)
+{
+    bool ok = FlushBatch();
+    mBatchActive = false;
+    return ok;
+}
+
+void mtsGalilController::BatchJoinedCommand(char *line, size_t &len, const char *cmd)
+{
+    size_t n = strlen(cmd);
+    if ((len > 0) && (len + n + 1 > VARIABLE_LINE_MAX)) {
+        SendGalilCommand(line);
+        len = 0;
     }
+    if (n > VARIABLE_LINE_MAX) {
+        SendGalilCommand(cmd);
+        return;
+    }
+    if (len > 0)
+        line[len++] = ';';
+    memcpy(line+len, cmd, n+1);
+    len += n;
+}
+
+void mtsGalilController::SendCommand(const std::string &cmdString)
+{
+    if (!CheckReady("SendCommand"))
+        return;
+    // Passthrough commands can change anything on the controller
+    ShadowInvalidateAll();
+    mJogActive = false;
+    SendGalilCommand(cmdString.c_str());
 }
 
 void mtsGalilController::SendCommandRet(const std::string &cmdString, std::string &retString)
 {
+    if (!CheckReady("SendCommandRet")) {
+        retString.clear();
+        return;
+    }
     if (mGalil) {
+        ShadowInvalidateAll();
+        mJogActive = false;
         char buffer[G_SMALL_BUFFER];
         char *firstChar;
         GReturn ret = GCmdT(mGalil, cmdString.c_str(), buffer, G_SMALL_BUFFER, &firstChar);
@@ -707,45 +2663,302 @@ void mtsGalilController::SendCommandRet(const std::string &cmdString, std::strin
     }
 }
 
+const mtsGalilController::VariableQuery &mtsGalilController::GetVariableQuery(const std::vector<std::string> &names)
+{
+    for (size_t q = 0; q < mVariableQueries.size(); q++) {
+        if (mVariableQueries[q].names == names)
+            return mVariableQueries[q];
+    }
+    // Not found, so create new entry (or replace oldest one)
+    VariableQuery *entry;
+    if (mVariableQueries.size() < VARIABLE_QUERIES_MAX) {
+        mVariableQueries.resize(mVariableQueries.size()+1);
+        entry = &mVariableQueries.back();
+    }
+    else {
+        entry = &mVariableQueries[mVariableQueryNext];
+        mVariableQueryNext = (mVariableQueryNext+1) % VARIABLE_QUERIES_MAX;
+    }
+    VariableQuery &query = *entry;
+    query.names = names;
+    query.commands.clear();
+    query.counts.clear();
+    std::string cmd;
+    size_t count = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        if ((count > 0) && (cmd.length() + names[i].length() + 1 > VARIABLE_LINE_MAX)) {
+            query.commands.push_back(cmd);
+            query.counts.push_back(count);
+            count = 0;
+        }
+        if (count == 0)
+            cmd.assign("MG ");
+        else
+            cmd.append(",");
+        cmd.append(names[i]);
+        count++;
+    }
+    if (count > 0) {
+        query.commands.push_back(cmd);
+        query.counts.push_back(count);
+    }
+    return query;
+}
+
+void mtsGalilController::ReadVariables(const std::vector<std::string> &names, vctDoubleVec &values)
+{
+    if (!CheckReady("ReadVariables")) {
+        values.SetSize(0);
+        return;
+    }
+    QueryVariables(names, values);
+}
+
+bool mtsGalilController::QueryVariables(const std::vector<std::string> &names, vctDoubleVec &values)
+{
+    values.SetSize(names.size());
+    if (!mGalil || names.empty())
+        return (mGalil != 0);
+
+    const VariableQuery &query = GetVariableQuery(names);
+    char buffer[G_SMALL_BUFFER];
+    size_t num = 0;
+    for (size_t c = 0; c < query.commands.size(); c++) {
+        char *result;
+        GReturn ret = GCmdT(mGalil, query.commands[c].c_str(), buffer, G_SMALL_BUFFER, &result);
+        if (ret != G_NO_ERROR) {
+            char buf[64];
+            sprintf(buf, "ReadVariables: error %d sending ", ret);
+            ReportMessage(MSG_ERROR, std::string(buf) + query.commands[c]);
+            values.SetSize(0);
+            return false;
+        }
+        // Values are parsed directly from the response buffer
+        if (ParseValues(result, values.Pointer(num), query.counts[c]) != query.counts[c]) {
+            ReportMessage(MSG_ERROR, "ReadVariables: could not parse response \"" + std::string(result)
+                          + "\" to " + query.commands[c]);
+            values.SetSize(0);
+            return false;
+        }
+        num += query.counts[c];
+    }
+    return true;
+}
+
+void mtsGalilController::WriteVariables(const GalilVariables &variables)
+{
+    if (!CheckReady("WriteVariables"))
+        return;
+    if (variables.names.size() != variables.values.size()) {
+        mInterface->SendError(this->GetName() + ": WriteVariables, number of names does not match number of values");
+        return;
+    }
+    // Several assignments per line, separated by semicolons (see BatchJoinedCommand)
+    char line[VARIABLE_LINE_MAX+1];
+    size_t len = 0;
+    BeginBatch();
+    for (size_t i = 0; i < variables.names.size(); i++) {
+        char assignment[VARIABLE_LINE_MAX+1];
+        int n = snprintf(assignment, sizeof(assignment), "%s=%.4lf",
+                         variables.names[i].c_str(), variables.values[i]);
+        if ((n < 0) || (static_cast<size_t>(n) >= sizeof(assignment))) {
+            mInterface->SendError(this->GetName() + ": WriteVariables, assignment too long for "
+                                  + variables.names[i]);
+            continue;
+        }
+        BatchJoinedCommand(line, len, assignment);
+    }
+    if (len > 0)
+        SendGalilCommand(line);
+    EndBatch();
+}
+
+void mtsGalilController::ShadowInvalidate(ShadowParam param, const bool *galilIndexMask)
+{
+    ShadowRegister &reg = mShadow[param];
+    for (unsigned int i = 0; i < GALIL_MAX_AXES; i++) {
+        if (!galilIndexMask || galilIndexMask[i])
+            reg.valid[i] = false;
+    }
+}
+
+void mtsGalilController::ShadowInvalidateAll(void)
+{
+    for (unsigned int p = 0; p < SHADOW_NUM; p++)
+        ShadowInvalidate(static_cast<ShadowParam>(p));
+}
+
+// Send command with values indexed by Galil index; if a shadow register is specified,
+// only the values that differ from the last values written are sent (e.g., "JG 1000,,")
+// and the command is skipped if nothing changed.
+bool mtsGalilController::SendCmdValues(const char *cmdGalil, const int32_t *galilData, ShadowParam shadow)
+{
+    if (shadow >= SHADOW_NUM)
+        return SendGalilCommand(WriteCmdValues(mBuffer, cmdGalil, galilData, mGalilIndexValid, mGalilIndexMax));
+
+    ShadowRegister &reg = mShadow[shadow];
+    bool changed[GALIL_MAX_AXES];
+    bool anyChanged = false;
+    unsigned int i;
+    for (i = 0; i < mGalilIndexMax; i++) {
+        changed[i] = mGalilIndexValid[i] && (!reg.valid[i] || (reg.value[i] != galilData[i]));
+        if (changed[i])
+            anyChanged = true;
+    }
+    if (!anyChanged) {
+        mCommandsSuppressed++;
+        return true;
+    }
+    if (!SendGalilCommand(WriteCmdValues(mBuffer, cmdGalil, galilData, changed, mGalilIndexMax))) {
+        // Not sure what the controller has now
+        ShadowInvalidate(shadow, changed);
+        return false;
+    }
+    for (i = 0; i < mGalilIndexMax; i++) {
+        if (changed[i]) {
+            reg.value[i] = galilData[i];
+            reg.valid[i] = true;
+        }
+    }
+    // JG updates SP on the Galil, so keep the two consistent
+    if (shadow == SHADOW_JG)
+        ShadowInvalidate(SHADOW_SP, changed);
+    else if (shadow == SHADOW_SP)
+        ShadowInvalidate(SHADOW_JG, changed);
+    return true;
+}
+
 // Enable motor power
 void mtsGalilController::EnableMotorPower(void)
 {
-    SendCommand(WriteCmdAxes(mBuffer, "SH ", mGalilAxes));
+    if (!CheckReady("EnableMotorPower"))
+        return;
+    DRActivity();
+    SendGalilCommand(WriteCmdAxes(mBuffer, "SH ", mGalilAxes));
 }
 
 // Disable motor power
 void mtsGalilController::DisableMotorPower(void)
 {
+    if (!CheckReady("DisableMotorPower"))
+        return;
+    ServoMailboxDiscard();
+    mJogActive = false;
     // Sending both ST and MO does not seem to work. Adding AM
     // in between does not seem to help either.
     if (mMotionActive) {
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
-        // TEMP: set speed in case previous command was servo_jv
+        SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
+        // Set speed in case previous command was servo_jv (skipped if unchanged)
         SetSpeed(mSpeed);
     }
-    SendCommand(WriteCmdAxes(mBuffer, "MO ", mGalilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "MO ", mGalilAxes));
+}
+
+// Called in the caller's thread (command not queued): the stop command is sent immediately
+// on the stop connection, ahead of any queued command, and Run is woken up to complete the
+// stop (see HandleStop). If the stop connection is not available, Run sends the stop.
+void mtsGalilController::RequestStop(StopRequest request)
+{
+    double t0 = osaGetTime();
+    bool sent = false;
+    mStopMutex.Lock();
+    if (mGalilStop && (mConnectionState == CONNECTION_READY)) {
+        if (request == STOP_ABORT)
+            sent = (GCmd(mGalilStop, "AB 1") == G_NO_ERROR);
+        else if (request == STOP_HOLD)
+            sent = (GCmd(mGalilStop, mStopCmdST) == G_NO_ERROR);
+        else {
+            // Same rule as DisableMotorPower: ST is only sent if motion is active
+            sent = !mMotionActive || (GCmd(mGalilStop, mStopCmdST) == G_NO_ERROR);
+            if (sent)
+                sent = (GCmd(mGalilStop, mStopCmdMO) == G_NO_ERROR);
+        }
+        if (sent) {
+            // Time from call to acknowledgement (callers are serialized by mStopMutex)
+            double *slot = mStopLatencyQueue.GetWriteSlot();
+            if (slot) {
+                *slot = osaGetTime() - t0;
+                mStopLatencyQueue.Push();
+            }
+        }
+    }
+    mStopMutex.Unlock();
+    if (sent)
+        mStopSent |= request;
+    mStopRequest |= request;
+    mRunSignal.Raise();
+}
+
+void mtsGalilController::HandleStop(unsigned int request, unsigned int sent)
+{
+    mDiscardMotion = true;
+    if (request & STOP_ABORT) {
+        if (sent & STOP_ABORT) {
+            ServoMailboxDiscard();
+            mJogActive = false;
+        }
+        else
+            AbortMotion();
+    }
+    if (request & STOP_MOTOR_OFF) {
+        if (sent & STOP_MOTOR_OFF) {
+            ServoMailboxDiscard();
+            mJogActive = false;
+            // Set speed in case previous command was servo_jv (skipped if unchanged)
+            SetSpeed(mSpeed);
+        }
+        else
+            DisableMotorPower();
+    }
+    if (request & STOP_HOLD) {
+        if (sent & STOP_HOLD) {
+            ServoMailboxDiscard();
+            mJogActive = false;
+            SetSpeed(mSpeed);
+        }
+        else
+            hold();
+    }
+}
+
+bool mtsGalilController::MotionAllowed(void)
+{
+    // Also check for a stop that has not yet been handled by Run
+    if (mDiscardMotion || (mStopRequest != 0)) {
+        mMotionDiscarded++;
+        mDiscardMotion = true;
+        return false;
+    }
+    return true;
 }
 
 void mtsGalilController::AbortProgram()
 {
-    SendCommand("AB");
+    if (!CheckReady("AbortProgram"))
+        return;
+    ServoMailboxDiscard();
+    mJogActive = false;
+    SendGalilCommand("AB");
 }
 
 void mtsGalilController::AbortMotion()
 {
-    SendCommand("AB 1");
+    if (!CheckReady("AbortMotion"))
+        return;
+    ServoMailboxDiscard();
+    mJogActive = false;
+    SendGalilCommand("AB 1");
 }
 
 bool mtsGalilController::galil_cmd_common(const char *cmdName, const char *cmdGalil,
-                                          const vctDoubleVec &data, bool useOffset)
+                                          const vctDoubleVec &data, bool useOffset, ShadowParam shadow)
 {
     if (!mGalil)
         return false;
 
     if (data.size() != mNumAxes) {
-        mInterface->SendError(this->GetName() + ": size mismatch in " + std::string(cmdName));
-        CMN_LOG_CLASS_RUN_ERROR << cmdName << ": size mismatch (data size = " << data.size()
-                                << ", num_axes = " << mNumAxes << ")" << std::endl;
+        ReportMessage(MSG_ERROR, FormatRunMessage("size mismatch in %s (data size = %d, num_axes = %d)", cmdName,
+                                                  static_cast<int>(data.size()), static_cast<int>(mNumAxes)));
         return false;
     }
 
@@ -759,20 +2972,18 @@ bool mtsGalilController::galil_cmd_common(const char *cmdName, const char *cmdGa
         galilData[galilIndex] = value;
     }
 
-    SendCommand(WriteCmdValues(mBuffer, cmdGalil, galilData, mGalilIndexValid, mGalilIndexMax));
-    return true;
+    return SendCmdValues(cmdGalil, galilData, shadow);
 }
 
 bool mtsGalilController::galil_cmd_common(const char *cmdName, const char *cmdGalil,
-                                          const vctIntVec &data)
+                                          const vctIntVec &data, ShadowParam shadow)
 {
     if (!mGalil)
         return false;
 
     if (data.size() != mNumAxes) {
-        mInterface->SendError(this->GetName() + ": size mismatch in " + std::string(cmdName));
-        CMN_LOG_CLASS_RUN_ERROR << cmdName << ": size mismatch (data size = " << data.size()
-                                << ", num_axes = " << mNumAxes << ")" << std::endl;
+        ReportMessage(MSG_ERROR, FormatRunMessage("size mismatch in %s (data size = %d, num_axes = %d)", cmdName,
+                                                  static_cast<int>(data.size()), static_cast<int>(mNumAxes)));
         return false;
     }
 
@@ -783,75 +2994,216 @@ bool mtsGalilController::galil_cmd_common(const char *cmdName, const char *cmdGa
         galilData[galilIndex] = data[i];
     }
 
-    SendCommand(WriteCmdValues(mBuffer, cmdGalil, galilData, mGalilIndexValid, mGalilIndexMax));
-    return true;
+    return SendCmdValues(cmdGalil, galilData, shadow);
+}
+
+void mtsGalilController::ServoMailboxPost(ServoMode mode, const char *cmdName, const vctDoubleVec &goal)
+{
+    if (goal.size() != mNumAxes) {
+        mInterface->SendError(FormatRunMessage("size mismatch in %s (data size = %d, num_axes = %d)", cmdName,
+                                               static_cast<int>(goal.size()), static_cast<int>(mNumAxes)));
+        return;
+    }
+    DRActivity();
+    // Latest goal wins; count the one that it replaces
+    if (mServoMailbox.mode != SERVO_NONE)
+        mServoSuperseded++;
+    mServoMailbox.mode = mode;
+    mServoMailbox.goal.Assign(goal);
+}
+
+void mtsGalilController::ServoMailboxDiscard(void)
+{
+    if (mServoMailbox.mode != SERVO_NONE) {
+        mServoSuperseded++;
+        mServoMailbox.mode = SERVO_NONE;
+    }
+}
+
+void mtsGalilController::ServoMailboxSend(void)
+{
+    ServoMode mode = mServoMailbox.mode;
+    if (mode == SERVO_NONE)
+        return;
+    mServoMailbox.mode = SERVO_NONE;
+
+    // Motor power may have changed since the goal was received
+    if (!mMotorPowerOn) {
+        mInterface->SendError(FormatRunMessage("%s: motor power is off",
+                                               (mode == SERVO_JP) ? "servo_jp" : "servo_jv"));
+        return;
+    }
+
+    if (mode == SERVO_JP) {
+        mJogActive = false;
+        // Stop motion if active, then set the goal, as one batch. BG is only sent if
+        // both succeed, since it would otherwise move to the previous goal.
+        BeginBatch();
+        if (mMotionActive)
+            SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
+        bool goalOK = galil_cmd_common("servo_jp", "PA ", mServoMailbox.goal, true);
+        if (EndBatch() && goalOK)
+            SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes));
+    }
+    else {
+        // Only need to send BG after the first JG command; afterwards, JG changes the
+        // speed of the ongoing jog (and unchanged axes are not resent).
+        // Note that JG actually updates SP on the Galil, but for now we do not update
+        // mSpeed -- that allows us to restore the previous speed when we stop.
+        if (galil_cmd_common("servo_jv", "JG ", mServoMailbox.goal, false, SHADOW_JG) && !mJogActive) {
+            if (SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes))) {
+                mJogActive = true;
+                mJogSettleCycles = 2;
+            }
+        }
+    }
 }
 
 void mtsGalilController::servo_jp(const prmPositionJointSet &jtpos)
 {
+    if (!CheckReady("servo_jp") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
-        mInterface->SendError("servo_jp: motor power is off");
+        mInterface->SendError(FormatRunMessage("servo_jp: motor power is off"));
         return;
     }
-    // Stop motion if active
-    if (mMotionActive)
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
-    if (galil_cmd_common("servo_jp", "PA ", jtpos.Goal(), true))
-        SendCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes));
+    ServoMailboxPost(SERVO_JP, "servo_jp", jtpos.Goal());
 }
 
 void mtsGalilController::servo_jr(const prmPositionJointSet &jtpos)
 {
+    if (!CheckReady("servo_jr") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
-        mInterface->SendError("servo_jr: motor power is off");
+        mInterface->SendError(FormatRunMessage("servo_jr: motor power is off"));
         return;
     }
+    DRActivity();
+    // Relative moves cannot be coalesced, so any pending goal is dropped
+    ServoMailboxDiscard();
+    mJogActive = false;
     // Stop motion if active
     if (mMotionActive)
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
+        SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
     if (galil_cmd_common("servo_jr", "PR ", jtpos.Goal(), false))
-        SendCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes));
+        SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes));
 }
 
 void mtsGalilController::servo_jv(const prmVelocityJointSet &jtvel)
 {
+    if (!CheckReady("servo_jv") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
-        mInterface->SendError("servo_jv: motor power is off");
+        mInterface->SendError(FormatRunMessage("servo_jv: motor power is off"));
+        return;
+    }
+    ServoMailboxPost(SERVO_JV, "servo_jv", jtvel.Goal());
+}
+
+void mtsGalilController::ScheduleCommand(const GalilTimedCommand &cmd)
+{
+    if (!CheckReady("ScheduleCommand") || !MotionAllowed())
+        return;
+    if (m_configuration.dispatcher_thread <= 0) {
+        mInterface->SendError(this->GetName() + ": ScheduleCommand requires dispatcher_thread in JSON file");
+        return;
+    }
+    int code = (cmd.command == "BG") ? 1 : ((cmd.command == "ST") ? 2 : 0);
+    if (code == 0) {
+        mInterface->SendError(this->GetName() + ": ScheduleCommand does not support " + cmd.command);
+        return;
+    }
+    if (cmd.axes.size() != mNumAxes) {
+        mInterface->SendError(this->GetName() + ": size mismatch in ScheduleCommand");
+        return;
+    }
+    unsigned int mask = 0;
+    for (size_t i = 0; i < mNumAxes; i++) {
+        if (cmd.axes[i])
+            mask |= (1 << mAxisToGalilIndexMap[i]);
+    }
+    if (code == 1) {
+        DRActivity();
+        ServoMailboxDiscard();
+        mJogActive = false;
+    }
+    // gdgo last, since the dispatcher starts when it is set
+    sprintf(mBuffer, "gdcmd=%d;gdmsk=%u;gdtgt=%s%ld;gdgo=1", code, mask,
+            cmd.relative ? "TIME+" : "", static_cast<long>(cmd.sample));
+    if (!SendGalilCommand(mBuffer))
         return;
+    double target = cmd.sample;
+    if (cmd.relative) {
+        vctDoubleVec value;
+        if (!QueryVariables(std::vector<std::string>(1, "gdtgt"), value)) {
+            mSchedulePending = false;
+            return;
+        }
+        target = value[0];
+    }
+    // Start of motion (BG) is detected from DR (see UpdateScheduleSkew)
+    mSchedulePending = (code == 1);
+    mScheduleTarget = static_cast<uint32_t>(static_cast<int64_t>(target));
+    mScheduleAxes.Assign(cmd.axes);
+}
+
+void mtsGalilController::UpdateScheduleSkew(void)
+{
+    // DR contains the lower 16 bits of the sample number
+    int16_t delta = static_cast<int16_t>(mSampleNum - static_cast<uint16_t>(mScheduleTarget));
+    if (delta < 0)
+        return;    // Target not yet reached (or axes were already moving)
+    bool started = false;
+    for (size_t i = 0; i < mNumAxes; i++) {
+        if (mScheduleAxes[i] && (mAxisStatus[i] & StatusMotorMoving))
+            started = true;
+    }
+    if (started) {
+        mScheduleSkew.Update(delta*mSamplePeriod);
+        mSchedulePending = false;
+    }
+    else if (delta > 16000) {
+        mInterface->SendWarning(FormatRunMessage("scheduled motion did not start"));
+        mSchedulePending = false;
     }
-    // TODO: Only need to send BG after the first JG command
-    // Note that JG actually updates SP on the Galil, but for now we do not update
-    // mSpeed -- that allows us to restore the previous speed when we stop.
-    if (galil_cmd_common("servo_jv", "JG ", jtvel.Goal(), false))
-        SendCommand(WriteCmdAxes(mBuffer, "BG ", mGalilAxes));
 }
 
 void mtsGalilController::hold(void)
 {
+    if (!CheckReady("hold"))
+        return;
     if (!mMotorPowerOn) {
         mInterface->SendError("hold: motor power is off");
         return;
     }
-    SendCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
-    // TEMP: set speed in case previous command was servo_jv
+    ServoMailboxDiscard();
+    mJogActive = false;
+    SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", mGalilAxes));
+    // Set speed in case previous command was servo_jv (skipped if unchanged)
     SetSpeed(mSpeed);
 }
 
 void mtsGalilController::SetSpeed(const vctDoubleVec &spd)
 {
-    if (galil_cmd_common("SetSpeed", "SP ", spd, false))
+    if (!CheckReady("SetSpeed"))
+        return;
+    if (galil_cmd_common("SetSpeed", "SP ", spd, false, SHADOW_SP))
         mSpeed = spd;
 }
 
 void mtsGalilController::SetAccel(const vctDoubleVec &accel)
 {
-    if (galil_cmd_common("SetAccel", "AC ", accel, false))
+    if (!CheckReady("SetAccel"))
+        return;
+    if (galil_cmd_common("SetAccel", "AC ", accel, false, SHADOW_AC))
         mAccel = accel;
 }
 
 void mtsGalilController::SetDecel(const vctDoubleVec &decel)
 {
-    if (galil_cmd_common("SetDecel", "DC ", decel, false))
+    if (!CheckReady("SetDecel"))
+        return;
+    if (galil_cmd_common("SetDecel", "DC ", decel, false, SHADOW_DC))
         mDecel = decel;
 }
 
@@ -886,75 +3238,94 @@ const char *mtsGalilController::GetGalilAxes(const bool *galilIndexValid) const
 
 void mtsGalilController::Home(const vctBoolVec &mask)
 {
+    if (!CheckReady("Home") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
         mInterface->SendError("Home: motor power is off");
         return;
     }
+    DRActivity();
+    ServoMailboxDiscard();
+    mJogActive = false;
     const bool *galilIndexValid = GetGalilIndexValid(mask);
     const char *galilAxes = GetGalilAxes(galilIndexValid);
 
     UnHome(mask);
     if (mMotionActive)
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
+        SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
 
     // Check whether limit needs to be disabled
     if (mHomeLimitDisable.Any() && (mHomeLimitDisable != mLimitDisable)) {
-        if (!galil_cmd_common("home (LD)", "LD ", mHomeLimitDisable)) {
+        if (!galil_cmd_common("home (LD)", "LD ", mHomeLimitDisable, SHADOW_LD)) {
             mInterface->SendError("Home: failed to disable limits");
             return;
         }
     }
 
-    SendCommand(WriteCmdAxes(mBuffer, "HM ", galilAxes));
-    SendCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "HM ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
     mState = ST_HOMING;
 }
 
 void mtsGalilController::UnHome(const vctBoolVec &mask)
 {
+    if (!CheckReady("UnHome"))
+        return;
     const bool *galilIndexValid = GetGalilIndexValid(mask);
     int32_t galilData[GALIL_MAX_AXES];
     for (unsigned int i = 0; i < mGalilIndexMax; i++)
         galilData[i] = 0;
-    SendCommand(WriteCmdValues(mBuffer, "ZA ", galilData, galilIndexValid, mGalilIndexMax));
+    SendGalilCommand(WriteCmdValues(mBuffer, "ZA ", galilData, galilIndexValid, mGalilIndexMax));
 }
 
 void mtsGalilController::FindEdge(const vctBoolVec &mask)
 {
+    if (!CheckReady("FindEdge") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
         mInterface->SendError("FindEdge: motor power is off");
         return;
     }
+    DRActivity();
+    ServoMailboxDiscard();
+    mJogActive = false;
     const bool *galilIndexValid = GetGalilIndexValid(mask);
     const char *galilAxes = GetGalilAxes(galilIndexValid);
 
     if (mMotionActive)
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
-    SendCommand(WriteCmdAxes(mBuffer, "FE ", galilAxes));
-    SendCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
+        SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "FE ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
 }
 
 void mtsGalilController::FindIndex(const vctBoolVec &mask)
 {
+    if (!CheckReady("FindIndex") || !MotionAllowed())
+        return;
     if (!mMotorPowerOn) {
         mInterface->SendError("FindIndex: motor power is off");
         return;
     }
+    DRActivity();
+    ServoMailboxDiscard();
+    mJogActive = false;
     const bool *galilIndexValid = GetGalilIndexValid(mask);
     const char *galilAxes = GetGalilAxes(galilIndexValid);
 
     if (mMotionActive)
-        SendCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
-    SendCommand(WriteCmdAxes(mBuffer, "FI ", galilAxes));
-    SendCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
+        SendGalilCommand(WriteCmdAxes(mBuffer, "ST ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "FI ", galilAxes));
+    SendGalilCommand(WriteCmdAxes(mBuffer, "BG ", galilAxes));
 }
 
 void mtsGalilController::SetHomePosition(const vctDoubleVec &pos)
 {
+    if (!CheckReady("SetHomePosition"))
+        return;
     if (galil_cmd_common("SetHomePosition", "DP ", pos, true)) {
         int32_t galilData[GALIL_MAX_AXES];
         for (unsigned int i = 0; i < mGalilIndexMax; i++)
             galilData[i] = 1;
-        SendCommand(WriteCmdValues(mBuffer, "ZA ", galilData, mGalilIndexValid, mGalilIndexMax));
+        SendGalilCommand(WriteCmdValues(mBuffer, "ZA ", galilData, mGalilIndexValid, mGalilIndexMax));
     }
 }
@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Fixed-size, lock-free ring buffer for passing data from one producer thread
+  to one consumer thread without memory allocation. The producer fills the slot
+  returned by GetWriteSlot and then calls Push; the consumer reads the slot
+  returned by GetReadSlot and then calls Pop.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilRingBuffer_h
+#define _GalilRingBuffer_h
+
+#include <cstddef>
+#include <atomic>
+
+template <class _elementType, size_t _size>
+class GalilRingBuffer
+{
+public:
+
+    GalilRingBuffer() : mHead(0), mTail(0) {}
+
+    // Producer: slot to fill, or 0 if the buffer is full
+    _elementType *GetWriteSlot(void)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) >= _size)
+            return 0;
+        return &mBuffer[head % _size];
+    }
+
+    // Producer: make the slot returned by GetWriteSlot available to the consumer
+    void Push(void)
+    {
+        mHead.store(mHead.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    }
+
+    // Consumer: oldest slot, or 0 if the buffer is empty
+    const _elementType *GetReadSlot(void) const
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire))
+            return 0;
+        return &mBuffer[tail % _size];
+    }
+
+    // Consumer: release the slot returned by GetReadSlot
+    void Pop(void)
+    {
+        mTail.store(mTail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    }
+
+    bool IsEmpty(void) const
+    {
+        return (mTail.load(std::memory_order_relaxed) == mHead.load(std::memory_order_acquire));
+    }
+
+private:
+    _elementType        mBuffer[_size];
+    std::atomic<size_t> mHead;      // Next slot to write (producer)
+    std::atomic<size_t> mTail;      // Next slot to read (consumer)
+};
+
+#endif // _GalilRingBuffer_h
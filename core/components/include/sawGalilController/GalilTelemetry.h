@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-      */
+/* ex: set filetype=c softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab:   */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Layout of the telemetry shared-memory segment published by mtsGalilController
+  (see telemetry_shm in the JSON file), and a header-only reader for C and C++
+  programs (POSIX, GCC or Clang).
+
+  The segment (shm_open name, e.g., "/galil_telemetry") contains a header, with
+  the latest sample, followed by a ring of history_length samples:
+
+      GalilTelemetryHeader                 (header_size bytes)
+      GalilTelemetrySample[history_length] (sample_size bytes each)
+
+  History entry n (n = 0, 1, ...) is in slot n % history_length, and head is the
+  number of entries written. Each sample is protected by its own sequence number
+  (seqlock): it is odd while the sample is being written, so a reader copies the
+  sample and retries if the sequence number was odd or has changed. Readers do
+  not make system calls (except to open and close the segment) and do not write
+  to the segment, so they have no effect on the component.
+
+  The version is incremented for incompatible changes of the layout; fields may
+  be added at the end of the structures (see header_size and sample_size).
+
+  Example:
+
+      GalilTelemetryReader reader;
+      GalilTelemetrySample sample;
+      if (galil_telemetry_open("/galil_telemetry", &reader) == 0) {
+          if (galil_telemetry_read_latest(&reader, &sample) == 0)
+              printf("%f\n", sample.measured_position[0]);
+          galil_telemetry_close(&reader);
+      }
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilTelemetry_h
+#define _GalilTelemetry_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define GALIL_TELEMETRY_MAGIC        0x544C4147u   /* "GALT" (little-endian) */
+#define GALIL_TELEMETRY_VERSION      1u
+#define GALIL_TELEMETRY_MAX_AXES     8
+#define GALIL_TELEMETRY_NAME_SIZE    64
+/* Maximum number of attempts to read a sample (e.g., if the writer stopped while writing) */
+#define GALIL_TELEMETRY_MAX_RETRIES  1000
+
+/* Flags */
+#define GALIL_TELEMETRY_MOTOR_POWER_ON  0x1u
+#define GALIL_TELEMETRY_MOVING          0x2u
+
+/* State of all axes from one data record (DR); 352 bytes */
+typedef struct {
+    uint32_t seq;                  /* Sequence number (odd while being written) */
+    uint32_t flags;                /* GALIL_TELEMETRY_MOTOR_POWER_ON, GALIL_TELEMETRY_MOVING */
+    uint64_t index;                /* History entry number (0 for the first DR) */
+    int64_t  sample;               /* Controller sample number (unwrapped) */
+    double   sample_time;          /* Estimated host time of sample (s, CLOCK_MONOTONIC) */
+    double   receive_time;         /* Host time at which the DR was received (s, CLOCK_MONOTONIC) */
+    uint32_t error_code;           /* Controller error code (see TC command) */
+    uint32_t amp_status;           /* Amplifier status */
+    double   measured_position[GALIL_TELEMETRY_MAX_AXES];  /* SI units (m or rad) */
+    double   measured_velocity[GALIL_TELEMETRY_MAX_AXES];  /* SI units (m/s or rad/s) */
+    double   setpoint_position[GALIL_TELEMETRY_MAX_AXES];  /* SI units (m or rad) */
+    double   setpoint_effort[GALIL_TELEMETRY_MAX_AXES];    /* Commanded torque (V) */
+    uint16_t axis_status[GALIL_TELEMETRY_MAX_AXES];        /* See Galil User Manual */
+    uint16_t analog_in[GALIL_TELEMETRY_MAX_AXES];
+    uint8_t  stop_code[GALIL_TELEMETRY_MAX_AXES];          /* See Galil SC command */
+    uint8_t  switches[GALIL_TELEMETRY_MAX_AXES];           /* See Galil TS command */
+} GalilTelemetrySample;
+
+/* Beginning of the segment; 456 bytes */
+typedef struct {
+    uint32_t magic;                /* GALIL_TELEMETRY_MAGIC, set once the segment is initialized */
+    uint32_t version;              /* GALIL_TELEMETRY_VERSION */
+    uint32_t header_size;          /* sizeof(GalilTelemetryHeader), offset of history */
+    uint32_t sample_size;          /* sizeof(GalilTelemetrySample) */
+    uint32_t num_axes;             /* Number of axes used in samples */
+    uint32_t history_length;       /* Number of samples in history */
+    uint64_t head;                 /* Number of history entries written */
+    uint32_t pid;                  /* Process id of writer */
+    uint32_t reserved;
+    char     name[GALIL_TELEMETRY_NAME_SIZE];   /* Component name */
+    GalilTelemetrySample latest;   /* Latest sample */
+} GalilTelemetryHeader;
+
+#if !defined(_WIN32)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    const GalilTelemetryHeader *header;
+    const GalilTelemetrySample *history;
+    size_t size;                   /* Size of mapping */
+} GalilTelemetryReader;
+
+/* Copy a sample (seqlock). Returns 0 on success, -1 if it could not be read. */
+static inline int galil_telemetry_read_sample(const GalilTelemetrySample *src, GalilTelemetrySample *dest)
+{
+    int i;
+    for (i = 0; i < GALIL_TELEMETRY_MAX_RETRIES; i++) {
+        uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
+            continue;
+        memcpy(dest, src, sizeof(GalilTelemetrySample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq) {
+            dest->seq = seq;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Map the segment (read-only). Returns 0 on success, -1 if the segment does not exist
+   or has an incompatible layout. */
+static inline int galil_telemetry_open(const char *name, GalilTelemetryReader *reader)
+{
+    struct stat st;
+    void *addr;
+    const GalilTelemetryHeader *header;
+    int fd = shm_open(name, O_RDONLY, 0);
+    reader->header = 0;
+    reader->history = 0;
+    reader->size = 0;
+    if (fd < 0)
+        return -1;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(GalilTelemetryHeader))) {
+        close(fd);
+        return -1;
+    }
+    addr = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return -1;
+    header = (const GalilTelemetryHeader *)addr;
+    if ((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != GALIL_TELEMETRY_MAGIC) ||
+        (header->version != GALIL_TELEMETRY_VERSION) ||
+        (header->header_size < sizeof(GalilTelemetryHeader)) ||
+        (header->sample_size != sizeof(GalilTelemetrySample)) ||
+        ((size_t)st.st_size < header->header_size + (size_t)header->history_length*header->sample_size)) {
+        munmap(addr, (size_t)st.st_size);
+        return -1;
+    }
+    reader->header = header;
+    reader->history = (const GalilTelemetrySample *)((const char *)addr + header->header_size);
+    reader->size = (size_t)st.st_size;
+    return 0;
+}
+
+static inline void galil_telemetry_close(GalilTelemetryReader *reader)
+{
+    if (reader->header)
+        munmap((void *)reader->header, reader->size);
+    reader->header = 0;
+    reader->history = 0;
+    reader->size = 0;
+}
+
+/* Latest sample. Returns 0 on success, -1 if there is no sample yet or it could not be read. */
+static inline int galil_telemetry_read_latest(const GalilTelemetryReader *reader, GalilTelemetrySample *sample)
+{
+    if (__atomic_load_n(&reader->header->latest.seq, __ATOMIC_ACQUIRE) == 0)
+        return -1;
+    return galil_telemetry_read_sample(&reader->header->latest, sample);
+}
+
+/* Number of history entries written (entries head-history_length to head-1 are available) */
+static inline uint64_t galil_telemetry_head(const GalilTelemetryReader *reader)
+{
+    return __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+}
+
+/* History entry n. Returns 0 on success, -1 if it is not available (not yet written or
+   overwritten). */
+static inline int galil_telemetry_read_history(const GalilTelemetryReader *reader, uint64_t n,
+                                               GalilTelemetrySample *sample)
+{
+    const GalilTelemetrySample *src = &reader->history[n % reader->header->history_length];
+    if (galil_telemetry_read_sample(src, sample) != 0)
+        return -1;
+    return ((sample->seq != 0) && (sample->index == n)) ? 0 : -1;
+}
+
+#endif /* !_WIN32 */
+
+#endif /* _GalilTelemetry_h */
@@ -30,10 +30,20 @@ http://www.cisst.org/cisst/license.txt.
 #define _mtsGalilController_h
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
 
 #include <cisstVector/vctDynamicVectorTypes.h>
+#include <cisstVector/vctDynamicMatrixTypes.h>
+#include <cisstOSAbstraction/osaThread.h>
+#include <cisstOSAbstraction/osaThreadSignal.h>
+#include <cisstOSAbstraction/osaMutex.h>
 #include <cisstMultiTask/mtsTaskContinuous.h>
 #include <cisstMultiTask/mtsInterfaceProvided.h>
+#include <cisstMultiTask/mtsCallableVoidBase.h>
+#include <cisstMultiTask/mtsFunctionVoid.h>
+#include <cisstMultiTask/mtsFunctionWrite.h>
 #include <cisstParameterTypes/prmConfigurationJoint.h>
 #include <cisstParameterTypes/prmStateJoint.h>
 #include <cisstParameterTypes/prmPositionJointSet.h>
@@ -43,10 +53,18 @@ http://www.cisst.org/cisst/license.txt.
 #include <cisstParameterTypes/prmActuatorState.h>
 
 #include <sawGalilController/sawGalilControllerConfig.h>
+#include <sawGalilController/sawGalilControllerTypes.h>
+#include <sawGalilController/GalilRingBuffer.h>
+#include <sawGalilController/GalilTelemetry.h>
 
 // Always include last
 #include <sawGalilController/sawGalilControllerExport.h>
 
+class GalilCommandPipeline;
+class GalilClockEstimator;
+class GalilDataRecordSocket;
+class GalilTelemetryWriter;
+
 class CISST_EXPORT mtsGalilController : public mtsTaskContinuous
 {
     CMN_DECLARE_SERVICES(CMN_DYNAMIC_CREATION_ONEARG, CMN_LOG_LOD_RUN_ERROR)
@@ -67,9 +85,22 @@ class CISST_EXPORT mtsGalilController : public mtsTaskContinuous
     void Run(void) override;
     void Cleanup(void) override;
 
+    // Commands queued for this component raise mRunSignal, so that Run does not wait for
+    // the next DR to execute them (same approach as mtsTaskFromSignal)
+    mtsInterfaceProvided *AddInterfaceProvidedWithoutSystemEvents(const std::string &interfaceProvidedName,
+                                                                  mtsInterfaceQueueingPolicy queueingPolicy = MTS_COMPONENT_POLICY,
+                                                                  bool isProxy = false) override;
+
 protected:
 
-    void         *mGalil;                   // Gcon
+    // Separate gclib connections, so that command responses, DR records and messages
+    // are not read from the same connection (see tests/GalilConnectionBenchmark.cpp for
+    // the effect on DR jitter with a simulated controller)
+    void         *mGalil;                   // Gcon for commands
+    void         *mGalilDR;                 // Gcon subscribed to DR records only
+    void         *mGalilMsg;                // Gcon subscribed to unsolicited messages (MG)
+    void         *mGalilEI;                 // Gcon subscribed to interrupts (EI)
+    GalilCommandPipeline *mPipeline;        // Pipelined raw TCP command channel (optional)
     sawGalilControllerConfig::controller m_configuration;
 
     unsigned int  mModel;                   // Galil model
@@ -84,6 +115,41 @@ protected:
     prmStateJoint m_setpoint_js;            // Setpoint joint state (CRTK)
     prmOperatingState m_op_state;           // Operating state (CRTK)
     prmActuatorState mActuatorState;        // Actuator state
+    GalilTimingStatistics mDRStatistics;    // DR inter-arrival time statistics
+    // Clock synchronization: the DR sample number is unwrapped and mapped to the host time
+    // (CLOCK_MONOTONIC on Linux) at which the sample was taken; the state table entries
+    // from the DR are timestamped with that time (in the time base of the state table).
+    GalilClockEstimator *mClock;
+    GalilClockSync mClockSync;              // Estimated offset, drift and jitter
+    // DR received on own UDP socket (if DR_kernel_timestamps), with kernel receive times
+    GalilDataRecordSocket *mDRSocket;
+    vctDoubleVec  mDRTimes;                 // Kernel receive and processing time of last DR
+    GalilTimingStatistics mDRWakeLatency;   // Processing time (in Run) minus kernel receive time
+    // Real-time profile (see realtime in JSON file); the jitter of the processing period
+    // (deviation from the DR period) is recorded before and after the profile is applied
+    enum { JITTER_BINS = 50 };
+    bool          mRealtimeApplied;         // Whether real-time profile has been applied
+    double        mDRLastProcess;           // Processing time of last DR (0 if none)
+    GalilHistogram mJitterBefore;           // Jitter before real-time profile
+    GalilHistogram mJitterAfter;            // Jitter after real-time profile
+    double        mDRLastArrival;           // Time of last DR arrival (0 if none)
+    // Adaptive DR rate: when no axis is moving and no motion command has been received for
+    // DR_idle_timeout_s, the DR period is increased to DR_idle_period_ms (if not 0). The fast
+    // rate is restored as soon as a motion command is received.
+    int           mDRPeriod;                // Current DR period (ms)
+    bool          mDRIdle;                  // Whether DR is at idle rate
+    double        mDRLastActivity;          // Time of last motion or motion command
+    double        mDRRateLastTime;          // Time of last update of mDRRateTime
+    vctDoubleVec  mDRRateTime;              // Time spent at fast [0] and idle [1] rate (s)
+    // Period of the component (time between processed DRs) at each rate, since the state
+    // table period statistics (period_statistics) mix both rates
+    GalilTimingStatistics mPeriodActive;
+    GalilTimingStatistics mPeriodIdle;
+    // Handle (0 for A, ...) of the DR connection on the controller, so that the DR rate can
+    // be set immediately on the command connection (DR n,h), rather than by the DR thread
+    // (which may be waiting for the next record at the idle rate); -1 if unknown
+    int           mDRHandle;
+    mtsFunctionWrite mDRPeriodEvent;        // Event with new DR period (ms)
     vctUIntVec    mAxisToGalilIndexMap;     // Map from axis number to Galil index
     vctUIntVec    mGalilIndexToAxisMap;     // Map from Galil index to axis number
     vctDoubleVec  mEncoderCountsPerUnit;    // Encoder conversion factors
@@ -95,8 +161,28 @@ protected:
     vctUCharVec   mStopCode;                // Axis stop code (see Galil SC command)
     vctUCharVec   mSwitches;                // Axis switches (see Galil TS command)
     vctUShortVec  mAnalogIn;                // Axis analog input
+    GalilSnapshot mSnapshot;                // All of the above, from the same DR
+    bool          mSnapshotNew;             // Whether snapshot was updated in this cycle
+    mtsFunctionWrite mSnapshotEvent;        // Event with snapshot (if snapshot_event)
+    // History of DR data, same length as the state table, for GetHistorySince (written
+    // and read by Run)
+    struct HistoryEntry {
+        int64_t  sample;
+        double   sampleTime;
+        double   measuredPos[GALIL_MAX_AXES];
+        double   measuredVel[GALIL_MAX_AXES];
+        double   setpointPos[GALIL_MAX_AXES];
+        uint16_t axisStatus[GALIL_MAX_AXES];
+        uint8_t  stopCode[GALIL_MAX_AXES];
+    };
+    std::vector<HistoryEntry> mHistory;
+    uint64_t      mHistoryHead;             // Number of entries written
+    // Latest DR and short history published in shared memory (if telemetry_shm is set),
+    // for out-of-process readers (see GalilTelemetry.h)
+    GalilTelemetryWriter *mTelemetry;
+    GalilTelemetrySample  mTelemetrySample;
     bool          mMotorPowerOn;            // Whether motor power is on (for all configured motors)
-    bool          mMotionActive;            // Whether a motion is active
+    std::atomic<bool> mMotionActive;        // Whether a motion is active (set by Run, also read by RequestStop)
     vctDoubleVec  mSpeedDefault;            // Default speed
     vctDoubleVec  mSpeed;                   // Current speed
     vctDoubleVec  mAccelDefault;            // Default accel
@@ -106,6 +192,41 @@ protected:
     unsigned int  mState;                   // Internal state machine
     mtsInterfaceProvided *mInterface;       // Provided interface
 
+    // Latest-wins mailbox for streamed servo commands (servo_jp, servo_jv).
+    // The command handlers only store the goal; the most recent goal is sent to
+    // the controller once per cycle (in Run, after ProcessQueuedCommands), so that
+    // a burst of commands does not lead to a growing queue of ST/PA/BG round trips.
+    enum ServoMode { SERVO_NONE, SERVO_JP, SERVO_JV };
+    struct ServoMailbox {
+        ServoMode    mode;                  // Pending command (SERVO_NONE if empty)
+        vctDoubleVec goal;                  // Pending goal (position or velocity)
+    } mServoMailbox;
+    unsigned int  mServoSuperseded;         // Number of servo goals that were never sent
+
+    // Shadow registers: last values written to the controller (indexed by Galil index)
+    // for frequently repeated commands, so that unchanged values are not resent.
+    // The cache is invalidated on (re)connect and by SendCommand/SendCommandRet.
+    enum ShadowParam { SHADOW_SP, SHADOW_AC, SHADOW_DC, SHADOW_JG, SHADOW_LD, SHADOW_NUM,
+                       SHADOW_NONE = SHADOW_NUM };
+    struct ShadowRegister {
+        int32_t value[GALIL_MAX_AXES];
+        bool    valid[GALIL_MAX_AXES];
+    } mShadow[SHADOW_NUM];
+    unsigned int  mCommandsSuppressed;      // Number of commands skipped (values unchanged)
+    bool          mJogActive;               // Whether servo_jv has started a jog (BG sent)
+    unsigned int  mJogSettleCycles;         // Cycles to wait after BG before checking for motion
+
+    // Command batching: between BeginBatch and EndBatch, SendGalilCommand queues the
+    // commands, which are then sent on the pipelined channel (if available) or one by one.
+    enum { BATCH_MAX_COMMANDS = 16, BATCH_BUFFER_SIZE = 2048 };
+    bool          mBatchActive;
+    char          mBatchBuffer[BATCH_BUFFER_SIZE];
+    size_t        mBatchUsed;               // Bytes used in mBatchBuffer
+    const char   *mBatchCmds[BATCH_MAX_COMMANDS];
+    size_t        mBatchNum;                // Number of commands in batch
+    GalilTimingStatistics mCommandStatistics;   // Time per command, one at a time (GCmd)
+    GalilTimingStatistics mPipelineStatistics;  // Time per command, pipelined batches
+
     // String of configured axes (e.g., "ABC")
     char mGalilAxes[GALIL_MAX_AXES+1];
     // String for querying (e.g., "?,?,?")
@@ -115,6 +236,123 @@ protected:
 
     char *mBuffer;                          // Local buffer for building command strings
 
+    // Thread that reads unsolicited messages (MG) on mGalilMsg, splits them into lines
+    // and queues them for Run, which forwards them as events.
+    // Lines starting with "ERR" are sent as errors, "WARN" as warnings, and others as
+    // status messages; all lines are also sent via the dmc_message event.
+    enum { MESSAGE_LINE_SIZE = 128, MESSAGE_QUEUE_SIZE = 64, MESSAGES_PER_CYCLE = 4 };
+    struct MessageLine {
+        char text[MESSAGE_LINE_SIZE];
+    };
+    osaThread         mMessageThread;
+    std::atomic<bool> mMessageThreadRunning;
+    GalilRingBuffer<MessageLine, MESSAGE_QUEUE_SIZE> mMessageQueue;
+    std::atomic<unsigned int> mMessagesDroppedCount;  // Lines dropped (queue full), updated by thread
+    unsigned int      mMessagesDropped;         // Copy of mMessagesDroppedCount for state table
+    mtsFunctionWrite  mDMCMessageEvent;
+    void *MessageThreadRun(int);
+    // Forward queued messages as events (called from Run)
+    void ProcessMessages(void);
+
+    // Thread that reads the DR (gclib or DR socket) and queues the records for Run, which waits
+    // for the next record, or for mRunSignal, for at most DR_max_wait_ms. The DR rate is also
+    // set by this thread if the DR handle is not known (see SetDRRate), since it is the only
+    // user of the DR connection.
+    enum { DR_RECORD_SIZE = 512, DR_QUEUE_SIZE = 16, DR_READ_TIMEOUT_MS = 100 };
+    struct DataRecordSlot {
+        int    ret;                         // GReturn (G_NO_ERROR, or error code)
+        double kernelTime;                  // Kernel receive time (see GalilDataRecordSocket)
+        double userTime;                    // Time when read by DR thread
+        char   data[DR_RECORD_SIZE];        // GDataRecord
+    };
+    osaThread         mDRThread;
+    std::atomic<bool> mDRThreadRunning;
+    std::atomic<int>  mDRRateRequest;       // DR period (ms) to be set by DR thread, -1 if none
+    GalilRingBuffer<DataRecordSlot, DR_QUEUE_SIZE> mDRQueue;
+    std::atomic<unsigned int> mDRDroppedCount;  // Records dropped (queue full), updated by thread
+    unsigned int      mDRDropped;           // Copy of mDRDroppedCount for state table
+    GalilTimingStatistics mDRQueueDelay;    // Time from DR read by DR thread to Run
+    osaThreadSignal   mRunSignal;           // Raised when a DR, a command or a stop is queued
+    mtsCallableVoidBase *mCommandQueuedCallable;  // Raises mRunSignal (called by the mailboxes)
+    void CommandQueued(void) { mRunSignal.Raise(); }
+    void *DRThreadRun(int);
+    void StartDRThread(void);
+    void StopDRThread(void);
+
+    // Stop-class commands (hold, AbortMotion, DisableMotorPower) are not queued: they are
+    // executed in the caller's thread, which sends the stop immediately on a dedicated
+    // connection and wakes up Run. Run then completes the stop and discards the motion
+    // commands processed in the same cycle, i.e., queued before the stop was handled by
+    // Run, which can include commands queued after the stop returned.
+    enum StopRequest { STOP_HOLD = 1, STOP_ABORT = 2, STOP_MOTOR_OFF = 4 };
+    void             *mGalilStop;           // Gcon for stop commands (protected by mStopMutex)
+    osaMutex          mStopMutex;
+    // Stop commands for the configured axes (e.g., "ST AB"), written with mGalilStop
+    enum { STOP_CMD_SIZE = 2*GALIL_MAX_AXES+4 };
+    char              mStopCmdST[STOP_CMD_SIZE];
+    char              mStopCmdMO[STOP_CMD_SIZE];
+    std::atomic<unsigned int> mStopRequest; // StopRequest bits, not yet handled by Run
+    std::atomic<unsigned int> mStopSent;    // StopRequest bits sent on mGalilStop
+    GalilRingBuffer<double, 16> mStopLatencyQueue;  // Latencies measured by callers
+    GalilTimingStatistics mStopLatency;     // Time from stop command to acknowledgement
+    bool              mDiscardMotion;       // Discarding motion commands (this cycle)
+    unsigned int      mMotionDiscarded;     // Motion commands discarded this cycle
+    unsigned int      mMotionDiscardedTotal;
+    void RequestStop(StopRequest request);
+    void RequestHold(void) { RequestStop(STOP_HOLD); }
+    void RequestAbortMotion(void) { RequestStop(STOP_ABORT); }
+    void RequestMotorOff(void) { RequestStop(STOP_MOTOR_OFF); }
+    void HandleStop(unsigned int request, unsigned int sent);
+    // Returns false (and counts the command) if motion commands are being discarded
+    bool MotionAllowed(void);
+
+    // Thread that reads interrupts (EI) on mGalilEI and queues the interrupt status
+    // bytes for Run, which sends them as events (motion_complete, limit_switch and
+    // input_interrupt). This reports motion completion without waiting for the DR record
+    // that shows that the axis stopped. For comparison, the time between the interrupt
+    // and the detection of the stop in the DR record is measured.
+    struct InterruptEvent {
+        uint8_t status;                     // Interrupt status byte (see Galil EI command)
+        double  time;                       // Host time when received
+    };
+    osaThread         mInterruptThread;
+    std::atomic<bool> mInterruptThreadRunning;
+    GalilRingBuffer<InterruptEvent, 32> mInterruptQueue;
+    double            mMotionCompleteTimeEI[GALIL_MAX_AXES];  // By axis, 0 if none pending
+    double            mMotionCompleteTimeDR[GALIL_MAX_AXES];  // By axis, 0 if none pending
+    bool              mAxisWasMoving[GALIL_MAX_AXES];         // By axis, from previous DR
+    GalilTimingStatistics mInterruptLatency;  // DR detection time minus interrupt time
+    vctBoolVec        mMotionCompleteMask;    // Argument for motion_complete event
+    mtsFunctionWrite  mMotionCompleteEvent;
+    mtsFunctionVoid   mLimitSwitchEvent;
+    mtsFunctionWrite  mInputInterruptEvent;
+    void *InterruptThreadRun(int);
+    // Send queued interrupts as events (called from Run)
+    void ProcessInterrupts(void);
+    // Update mInterruptLatency when motion complete has been detected by both EI and DR
+    void UpdateInterruptLatency(size_t axis);
+
+    // Low-rate queries for data that is not in the DR record (e.g., TT, TV or user
+    // variables, see "queries" in JSON file, and the homed flag for models without ZA in DR).
+    // Due queries are issued round-robin on the command connection, within a time budget
+    // per Run cycle, and the results are stored in the state table.
+    struct ScheduledQuery {
+        std::string  command;               // Galil query command (e.g., "TT")
+        double       period;                // Query period (s)
+        double       nextTime;              // Time when query is next due
+        double       cost;                  // Estimated query duration (s)
+        bool         overBudget;            // Whether query does not fit in budget (reported once)
+        int          row;                   // Row in mQueryResults (-1 for homed query)
+    };
+    std::vector<ScheduledQuery> mQueries;
+    size_t        mQueryNext;               // Next query to consider (round-robin)
+    vctDoubleMat  mQueryResults;            // Results of configured queries (one row per query)
+    std::vector<std::string> mQueryNames;   // Names of configured queries
+    vctBoolVec    mIsHomed;                 // Homed flag from query (models without ZA in DR)
+    void GetQueryNames(std::vector<std::string> &names) const { names = mQueryNames; }
+    // Issue due queries (called from Run)
+    void RunQueries(void);
+
     // Local static method to write cmd and axes to buffer
     // Parameters:
     //    buf    Buffer for output
@@ -145,19 +383,190 @@ protected:
     const char *GetGalilAxes(const bool *galilIndexValid) const;
 
     void Init();
+    // Open a connection to the controller, appending gclib options (e.g., "-s DR")
+    bool OpenConnection(void **galil, const char *options, const char *description);
     void Close();
 
     static unsigned int GetModelIndex(unsigned int modelType);
 
     void SetupInterfaces();
+    // Copy the state from the current DR to mSnapshot
+    void UpdateSnapshot(int64_t sample, double sampleTime, double receiveTime);
+    // Add the current DR data to mHistory
+    void UpdateHistory(int64_t sample, double sampleTime);
+    // Publish the current DR data in shared memory (host times, i.e., CLOCK_MONOTONIC)
+    void UpdateTelemetry(int64_t sample, double hostSampleTime, double hostReceiveTime);
+    // Data from DRs after the requested sample (queued, so that it does not race with Run)
+    void GetHistorySince(const GalilHistoryRequest &request, GalilHistory &history);
 
     void GetNumAxes(unsigned int &numAxes) const { numAxes = mNumAxes; }
     void GetHeader(uint32_t &header) const { header = mHeader; }
-    void GetConnected(bool &val) const { val = (mGalil != 0); }
-
+    void GetConnected(bool &val) const { val = (mConnectionState == CONNECTION_READY); }
+    void ResetDRStatistics(void) {
+        mDRStatistics.Reset(); mPeriodActive.Reset(); mPeriodIdle.Reset(); mDRQueueDelay.Reset();
+        mDRLastArrival = 0.0;
+    }
+
+    // Connection management: if the controller cannot be reached (at startup or after
+    // DR_ERRORS_DISCONNECT consecutive GRecord errors), Run is paced and a background
+    // thread checks, with exponential backoff, when the controller can be reached again.
+    // Run then reconnects (see Connect).
+    unsigned int      mDRErrors;            // Consecutive GRecord errors
+    // Repeated errors (e.g., GRecord errors while the link is down) are aggregated by source
+    // and code: the first occurrence is reported immediately, then a summary with the number
+    // of occurrences every error_summary_period_s, and a status message when the error stops
+    // (i.e., the next success from the same source).
+    enum ErrorSource { ERROR_SOURCE_DR, ERROR_SOURCE_COMMAND, ERROR_SOURCE_PIPELINE, ERROR_SOURCE_NUM };
+    enum { ERROR_TABLE_SIZE = 16 };
+    struct ErrorEntry {
+        int          source;                // ErrorSource (-1 if entry not used)
+        int          code;
+        unsigned int count;                 // Total number of occurrences
+        unsigned int countSinceReport;      // Occurrences since last report
+        unsigned int firstCount;            // Value of count at first occurrence
+        double       firstTime;             // Time of first occurrence (since recovered)
+        double       lastReport;            // Time of last report
+        bool         active;
+    };
+    ErrorEntry         mErrorTable[ERROR_TABLE_SIZE];
+    unsigned int       mActiveErrors;       // Number of active entries
+    GalilErrorCounters mErrorCounters;      // Counters (copy of mErrorTable) for state table
+    void ReportRepeatedError(ErrorSource source, int code, const char *detail = 0);
+    void ErrorRecovered(ErrorSource source);
+    // Send summaries of active errors (called from Run)
+    void UpdateErrorSummaries(double now);
+    void UpdateErrorCounters(void);
+    void GetErrorSourceNames(std::vector<std::string> &names) const;
+    bool              mWasConnected;        // Whether controller has been connected before
+    osaThread         mReconnectThread;
+    std::atomic<bool> mReconnectThreadRunning;
+    std::atomic<bool> mReconnectReady;      // Set by reconnect thread when controller is reachable
+    mtsFunctionWrite  mConnectedEvent;      // Event when connected (true) or disconnected (false)
+    // Bring-up (Connect) is done by a background thread, so that Startup does not block.
+    // Commands are rejected until the controller is ready, and Run does not use the state set
+    // by Connect (e.g., queries, shadow registers, clock) until then; state table data from
+    // the bring-up (e.g., mSpeed) is set by Run when the thread has finished. Progress is
+    // reported by Run (UpdateBringUp), using the startup_phase event, and the time taken by
+    // each phase is available from GetStartupTimes.
+    enum ConnectionState { CONNECTION_DISCONNECTED, CONNECTION_STARTING, CONNECTION_READY };
+    std::atomic<ConnectionState> mConnectionState;  // Changed by Run (and Startup), read by other threads
+    enum BringUpPhase { PHASE_CONNECT, PHASE_MODEL, PHASE_DOWNLOAD, PHASE_PARAMETERS,
+                        PHASE_HELPERS, PHASE_DATA_RECORD, PHASE_NUM };
+    osaThread         mBringUpThread;
+    std::atomic<bool> mBringUpDone;
+    std::atomic<bool> mBringUpOk;
+    bool              mBringUpMotionOk;     // Default speed, accel and decel were sent
+    std::atomic<int>  mBringUpPhase;        // Current phase (set by bring-up thread)
+    int               mBringUpPhaseReported;  // Last phase reported by Run
+    double            mBringUpPhaseStart;   // Start time of current phase
+    double            mBringUpPhaseTimes[PHASE_NUM];
+    vctDoubleVec      mStartupTimes;        // Time taken by each phase (s)
+    mtsFunctionWrite  mStartupPhaseEvent;
+    enum MessageLevel { MSG_STATUS, MSG_WARNING, MSG_ERROR };
+    struct BringUpMessage {
+        MessageLevel level;
+        std::string  text;
+    };
+    // Messages from the bring-up thread are queued (protected by mBringUpMutex) and formatted
+    // into their own string, since Run keeps running (and reporting) during bring-up
+    std::vector<BringUpMessage> mBringUpMessages;  // Messages queued during bring-up
+    osaMutex          mBringUpMutex;
+    std::string       mBringUpText;         // Formatted message (see FormatRunMessage)
+    std::atomic<std::thread::id> mBringUpThreadId;  // Id of bring-up thread, while it runs
+    bool IsBringUpThread(void) const { return (std::this_thread::get_id() == mBringUpThreadId.load()); }
+    void StartBringUp(void);
+    void *BringUpThreadRun(int);
+    void SetBringUpPhase(BringUpPhase phase);
+    void UpdateBringUp(void);
+    void GetStartupPhaseNames(std::vector<std::string> &names) const;
+    // Send status, warning or error (queued if called from the bring-up thread)
+    void ReportMessage(MessageLevel level, const std::string &text);
+    // Messages sent from Run (and the servo commands) are formatted into preallocated strings
+    // (see sawGalilControllerAllocationTest for what is checked not to allocate memory)
+    enum { RUN_MESSAGE_SIZE = 256 };
+    std::string   mRunMessage;              // Formatted message (see FormatRunMessage)
+    std::string   mDMCMessage;              // Message from DMC program (see ProcessMessages)
+    // printf-style message, prefixed by component name; returns mRunMessage (or mBringUpText
+    // in the bring-up thread)
+    const std::string &FormatRunMessage(const char *format, ...);
+    // Returns true if controller is ready, else sends error for cmdName
+    bool CheckReady(const char *cmdName);
+    bool SendMotionParameters(const vctDoubleVec &spd, const vctDoubleVec &accel,
+                              const vctDoubleVec &decel);
+    bool DownloadProgram(void);
+    std::string GetDispatcherProgram(void) const;
+    // Apply the parameters from the JSON file: query all values, send the ones that differ
+    // (several commands per line) and check them
+    bool ApplyParameters(void);
+    // Open connections and bring up the controller (returns false on failure)
+    bool Connect(void);
+    void ConnectionLost(void);
+    void Reconnect(void);
+    void StartReconnect(void);
+    void StopReconnect(void);
+    void *ReconnectThreadRun(int);
+
+    // Apply real-time profile to the component thread (and lock memory)
+    void ApplyRealtime(void);
+    // Set DR period (gclib or DR socket)
+    bool SetRecordRate(int periodMs);
+    // Set DR rate to idle or fast (DR_period_ms) rate
+    bool SetDRRate(bool idle);
+    unsigned int DRPeriodToSamples(int periodMs) const;
+    // Update time in each DR rate and switch to idle rate if appropriate (called from Run)
+    void UpdateDRRate(double now);
+    // Called for motion commands, to switch to fast DR rate if needed
+    void DRActivity(void);
+    void ResetCommandStatistics(void) { mCommandStatistics.Reset(); mPipelineStatistics.Reset(); }
+
+    // Send command to Galil (returns false on error); used internally, whereas
+    // SendCommand (passthrough) also invalidates the shadow registers
+    bool SendGalilCommand(const char *cmdString);
+    // Start batch of commands (see mBatchActive)
+    void BeginBatch(void);
+    // Send commands in current batch (but stay in batch mode)
+    bool FlushBatch(void);
+    // Send commands in current batch and leave batch mode
+    bool EndBatch(void);
+    // Add command that can share a line with others (e.g., assignment) to the batch: it is
+    // appended to line (len characters), separated by ';', and line is sent when full.
+    // Send the remaining line (if len > 0) at the end of the batch.
+    void BatchJoinedCommand(char *line, size_t &len, const char *cmd);
     void SendCommand(const std::string& cmdString);
     void SendCommandRet(const std::string& cmdString, std::string &retString);
 
+    // Read DMC program variables (or array elements, e.g., "arr[2]") using "MG a,b,c",
+    // split into as few lines as possible. Values are empty on error.
+    void ReadVariables(const std::vector<std::string> &names, vctDoubleVec &values);
+    // Implementation of ReadVariables (returns false on error)
+    bool QueryVariables(const std::vector<std::string> &names, vctDoubleVec &values);
+    // Write DMC program variables using "a=1;b=2;c=3"
+    void WriteVariables(const GalilVariables &variables);
+
+    // Execute BG or ST at a given controller time (TIME, in samples), using the dispatcher
+    // routine (see GetDispatcherProgram) running in dispatcher_thread on the controller.
+    // For BG, the skew between the target time and the start of motion (seen in DR) is
+    // measured; since it is measured from DR, its resolution is the DR period.
+    void ScheduleCommand(const GalilTimedCommand &cmd);
+    void UpdateScheduleSkew(void);
+    double        mSamplePeriod;            // Controller sample period (s), from TM
+    bool          mSchedulePending;         // Waiting for scheduled motion to start
+    uint32_t      mScheduleTarget;          // Target time (samples)
+    vctBoolVec    mScheduleAxes;            // Axes of scheduled command
+    GalilTimingStatistics mScheduleSkew;    // Start of motion minus target time (s)
+
+    // Preformatted MG commands for recent ReadVariables requests, so that repeated
+    // reads of the same names do not need to format the commands again
+    enum { VARIABLE_LINE_MAX = 80, VARIABLE_QUERIES_MAX = 8 };
+    struct VariableQuery {
+        std::vector<std::string> names;
+        std::vector<std::string> commands;  // MG commands
+        std::vector<size_t> counts;         // Number of values returned by each command
+    };
+    std::vector<VariableQuery> mVariableQueries;
+    size_t mVariableQueryNext;              // Next entry to replace when cache is full
+    const VariableQuery &GetVariableQuery(const std::vector<std::string> &names);
+
     // Enable motor power
     void EnableMotorPower(void);
     // Disable motor power
@@ -167,10 +576,23 @@ protected:
     void AbortProgram();
     void AbortMotion();
 
+    // Shadow register methods (galilIndexMask of 0 means all axes)
+    void ShadowInvalidate(ShadowParam param, const bool *galilIndexMask = 0);
+    void ShadowInvalidateAll(void);
+    // Send command with values (indexed by Galil index), using shadow register if specified
+    bool SendCmdValues(const char *cmdGalil, const int32_t *galilData, ShadowParam shadow);
+
     // Common methods for sending command to Galil
     bool galil_cmd_common(const char *cmdName, const char *cmdGalil, const vctDoubleVec &goal,
-                          bool useOffset);
-    bool galil_cmd_common(const char *cmdName, const char *cmdGalil, const vctIntVec &data);
+                          bool useOffset, ShadowParam shadow = SHADOW_NONE);
+    bool galil_cmd_common(const char *cmdName, const char *cmdGalil, const vctIntVec &data,
+                          ShadowParam shadow = SHADOW_NONE);
+
+    // Servo mailbox: store goal (overwriting any pending goal), discard pending goal,
+    // and send pending goal to the controller
+    void ServoMailboxPost(ServoMode mode, const char *cmdName, const vctDoubleVec &goal);
+    void ServoMailboxDiscard(void);
+    void ServoMailboxSend(void);
 
     // Move joint to specified position
     void servo_jp(const prmPositionJointSet &jtpos);
@@ -0,0 +1,245 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Checks that Run and the servo commands (servo_jp, servo_jr, servo_jv) do not
+  allocate memory in steady state, i.e., once the controller is connected and
+  while no errors, warnings or controller messages are reported. The global
+  operator new is replaced to count allocations (in all threads) and the
+  component is run with a simulated controller (see GalilFakeGclib.cpp). The
+  servo commands are sent through a required interface, i.e., queued as by any
+  client, and executed by Run.
+
+  Then, commands fail (injected errors): the first error and the periodic
+  summaries are sent as messages, which allocate memory (see README), but the
+  cycles that do not send a message must not allocate.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <atomic>
+
+#include <cisstCommon/cmnLogger.h>
+#include <cisstMultiTask/mtsManagerLocal.h>
+#include <cisstMultiTask/mtsInterfaceRequired.h>
+#include <sawGalilController/mtsGalilController.h>
+
+#include "GalilFakeGclib.h"
+
+// Number of cycles (Run and one servo command) before and while counting allocations
+const unsigned int WARMUP_CYCLES = 1000;
+const unsigned int TEST_CYCLES = 100000;
+// Number of cycles with injected command errors (several error summaries)
+const unsigned int ERROR_CYCLES = 5000;
+// Maximum number of Run calls to wait for the bring-up
+const unsigned int BRINGUP_CYCLES = 100;
+
+static std::atomic<bool> Counting(false);
+static std::atomic<unsigned long> Allocations(0);
+
+static void *CountedAlloc(std::size_t size)
+{
+    if (Counting.load(std::memory_order_relaxed))
+        Allocations++;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new(std::size_t size) { return CountedAlloc(size); }
+void *operator new[](std::size_t size) { return CountedAlloc(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return CountedAlloc(size); } catch (...) { return 0; }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return CountedAlloc(size); } catch (...) { return 0; }
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { free(ptr); }
+
+// Gives access to the connection state
+class GalilAllocationTest : public mtsGalilController
+{
+public:
+    GalilAllocationTest(const std::string &name) : mtsGalilController(name) {}
+
+    bool IsConnected(void) const
+    {
+        bool connected;
+        GetConnected(connected);
+        return connected;
+    }
+};
+
+// Client that sends the servo commands and counts the messages from the controller
+class GalilAllocationClient : public mtsComponent
+{
+public:
+    GalilAllocationClient(const std::string &name) : mtsComponent(name), mNumMessages(0)
+    {
+        mtsInterfaceRequired *req = AddInterfaceRequired("Control");
+        if (req) {
+            req->AddFunction("servo_jp", servo_jp);
+            req->AddFunction("servo_jr", servo_jr);
+            req->AddFunction("servo_jv", servo_jv);
+            // Not queued, i.e., called by Run when the message is sent
+            req->AddEventHandlerWrite(&GalilAllocationClient::OnMessage, this, "status", MTS_EVENT_NOT_QUEUED);
+            req->AddEventHandlerWrite(&GalilAllocationClient::OnMessage, this, "warning", MTS_EVENT_NOT_QUEUED);
+            req->AddEventHandlerWrite(&GalilAllocationClient::OnMessage, this, "error", MTS_EVENT_NOT_QUEUED);
+        }
+    }
+
+    void SetSize(size_t numAxes)
+    {
+        mPos.Goal().SetSize(numAxes);
+        mVel.Goal().SetSize(numAxes);
+    }
+
+    // One servo command (alternating between the three)
+    void Send(unsigned int i)
+    {
+        switch (i%3) {
+        case 0:
+            mPos.Goal().SetAll(1.0e-3*((i/3)%10));
+            servo_jp(mPos);
+            break;
+        case 1:
+            mPos.Goal().SetAll(1.0e-6);
+            servo_jr(mPos);
+            break;
+        default:
+            mVel.Goal().SetAll(1.0e-3);
+            servo_jv(mVel);
+            break;
+        }
+    }
+
+    unsigned int NumMessages(void) const { return mNumMessages; }
+
+protected:
+    mtsFunctionWrite servo_jp;
+    mtsFunctionWrite servo_jr;
+    mtsFunctionWrite servo_jv;
+    prmPositionJointSet mPos;
+    prmVelocityJointSet mVel;
+    unsigned int mNumMessages;
+
+    void OnMessage(const mtsMessage &) { mNumMessages++; }
+};
+
+int main(void)
+{
+    cmnLogger::SetMask(CMN_LOG_ALLOW_ERRORS);
+
+    const char *configFile = "GalilAllocationTest.json";
+    {
+        std::ofstream config(configFile);
+        config << "{ \"file_version\": 1, \"name\": \"AllocationTest\", \"IP_address\": \"simulated\",\n"
+               << "  \"DR_period_ms\": 1,\n"
+               << "  \"axes\": [\n";
+        for (int i = 0; i < 2; i++) {
+            config << "    { \"index\": " << i << ", \"type\": 1,\n"
+                   << "      \"position_bits_to_SI\": { \"scale\": 1000000, \"offset\": 0 },\n"
+                   << "      \"position_limits\": { \"lower\": -0.05, \"upper\": 0.05 } }"
+                   << ((i == 0) ? ",\n" : "\n");
+        }
+        config << "  ] }\n";
+    }
+
+    // Owned by the component manager
+    GalilAllocationTest *controller = new GalilAllocationTest("Galil");
+    GalilAllocationClient *client = new GalilAllocationClient("AllocationClient");
+    controller->Configure(configFile);
+    client->SetSize(2);
+    mtsManagerLocal *componentManager = mtsManagerLocal::GetInstance();
+    componentManager->AddComponent(controller);
+    componentManager->AddComponent(client);
+    if (!componentManager->Connect(client->GetName(), "Control", controller->GetName(), "control")) {
+        printf("FAILED: could not connect client\n");
+        return 1;
+    }
+    controller->Startup();
+
+    for (unsigned int i = 0; (i < BRINGUP_CYCLES) && !controller->IsConnected(); i++)
+        controller->Run();
+    if (!controller->IsConnected()) {
+        printf("FAILED: simulated controller not connected\n");
+        controller->Cleanup();
+        return 1;
+    }
+
+    // Warm-up, e.g., so that the clock synchronization and the statistics are initialized
+    // and the argument queues of the servo commands are filled once
+    unsigned int i;
+    for (i = 0; i < WARMUP_CYCLES; i++) {
+        client->Send(i);
+        controller->Run();
+    }
+
+    Counting = true;
+    for (; i < WARMUP_CYCLES+TEST_CYCLES; i++) {
+        client->Send(i);
+        controller->Run();
+    }
+    Counting = false;
+    const unsigned long allocations = Allocations;
+
+    // Failing commands: only count the cycles that do not send a message
+    GalilFakeSetCommandError(G_BAD_RESPONSE_QUESTION_MARK);
+    unsigned long errorAllocations = 0;
+    unsigned int messageCycles = 0;
+    for (unsigned int e = 0; e < ERROR_CYCLES; e++, i++) {
+        const unsigned int messages = client->NumMessages();
+        Allocations = 0;
+        Counting = true;
+        client->Send(i);
+        controller->Run();
+        Counting = false;
+        if (client->NumMessages() != messages)
+            messageCycles++;
+        else
+            errorAllocations += Allocations;
+    }
+    GalilFakeSetCommandError(G_NO_ERROR);
+
+    controller->Cleanup();
+    std::remove(configFile);
+
+    bool ok = true;
+    if (allocations != 0) {
+        printf("FAILED: %lu allocations in %u cycles\n", allocations, TEST_CYCLES);
+        ok = false;
+    }
+    else
+        printf("PASSED: no allocations in %u cycles\n", TEST_CYCLES);
+    if (messageCycles == 0) {
+        printf("FAILED: no error reported in %u cycles with failing commands\n", ERROR_CYCLES);
+        ok = false;
+    }
+    else if (errorAllocations != 0) {
+        printf("FAILED: %lu allocations in %u cycles with failing commands (without messages)\n",
+               errorAllocations, ERROR_CYCLES - messageCycles);
+        ok = false;
+    }
+    else
+        printf("PASSED: no allocations in %u cycles with failing commands (%u cycles with messages)\n",
+               ERROR_CYCLES - messageCycles, messageCycles);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Measures the DR inter-arrival time (GetDRStatistics) while Run sends commands
+  at a high rate, with separate connections for commands, DR records and messages
+  (as used by the component) and with a single shared connection, with the
+  simulated controller (see GalilFakeGclib.cpp). The simulated connection only
+  models the lock that serializes calls on a gclib connection: a record that
+  arrives while a command holds the connection is returned when the command
+  completes. Network and controller delays are not modeled.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstdio>
+#include <fstream>
+
+#include <cisstCommon/cmnLogger.h>
+#include <sawGalilController/mtsGalilController.h>
+
+#include "GalilFakeGclib.h"
+
+// Number of cycles (Run and the commands) before and while measuring
+const unsigned int WARMUP_CYCLES = 500;
+const unsigned int TEST_CYCLES = 5000;
+// Maximum number of Run calls to wait for the bring-up
+const unsigned int BRINGUP_CYCLES = 100;
+// Command traffic: commands per cycle and time each command holds its connection
+const unsigned int COMMANDS_PER_CYCLE = 4;
+const long COMMAND_TIME_US = 150;
+
+// Gives access to the commands and the DR statistics
+class GalilConnectionBenchmark : public mtsGalilController
+{
+public:
+    GalilConnectionBenchmark(const std::string &name) : mtsGalilController(name) {}
+
+    bool IsConnected(void) const
+    {
+        bool connected;
+        GetConnected(connected);
+        return connected;
+    }
+
+    // Commands followed by Run
+    void Cycle(void)
+    {
+        for (unsigned int i = 0; i < COMMANDS_PER_CYCLE; i++)
+            SendGalilCommand("TP");
+        Run();
+    }
+
+    void ResetStatistics(void) { ResetDRStatistics(); }
+    const GalilTimingStatistics &DRStatistics(void) const { return mDRStatistics; }
+};
+
+static bool Measure(const char *name, const char *configFile, bool shared)
+{
+    GalilFakeSetSharedConnection(shared);
+    GalilConnectionBenchmark controller(name);
+    controller.Configure(configFile);
+    controller.Startup();
+    for (unsigned int i = 0; (i < BRINGUP_CYCLES) && !controller.IsConnected(); i++)
+        controller.Run();
+    if (!controller.IsConnected()) {
+        printf("FAILED: simulated controller not connected (%s)\n", name);
+        controller.Cleanup();
+        return false;
+    }
+
+    unsigned int i;
+    for (i = 0; i < WARMUP_CYCLES; i++)
+        controller.Cycle();
+    controller.ResetStatistics();
+    for (i = 0; i < TEST_CYCLES; i++)
+        controller.Cycle();
+    const GalilTimingStatistics stats = controller.DRStatistics();
+    controller.Cleanup();
+
+    if (stats.number_of_samples == 0) {
+        printf("FAILED: no DR received (%s)\n", name);
+        return false;
+    }
+    printf("%-10s DR inter-arrival (ms): samples %lu, mean %.3lf, std dev %.3lf, min %.3lf, max %.3lf\n",
+           name, static_cast<unsigned long>(stats.number_of_samples), 1000.0*stats.mean,
+           1000.0*stats.std_dev, 1000.0*stats.minimum, 1000.0*stats.maximum);
+    return true;
+}
+
+int main(void)
+{
+    cmnLogger::SetMask(CMN_LOG_ALLOW_ERRORS);
+
+    const char *configFile = "GalilConnectionBenchmark.json";
+    {
+        std::ofstream config(configFile);
+        config << "{ \"file_version\": 1, \"name\": \"ConnectionBenchmark\", \"IP_address\": \"simulated\",\n"
+               << "  \"DR_period_ms\": 1,\n"
+               << "  \"axes\": [\n";
+        for (int i = 0; i < 2; i++) {
+            config << "    { \"index\": " << i << ", \"type\": 1,\n"
+                   << "      \"position_bits_to_SI\": { \"scale\": 1000000, \"offset\": 0 } }"
+                   << ((i == 0) ? ",\n" : "\n");
+        }
+        config << "  ] }\n";
+    }
+
+    printf("%u commands per cycle, %ld usec each, DR period 1 ms\n", COMMANDS_PER_CYCLE, COMMAND_TIME_US);
+    GalilFakeSetCommandTime(COMMAND_TIME_US);
+    bool ok = Measure("separate", configFile, false);
+    if (ok)
+        ok = Measure("shared", configFile, true);
+    GalilFakeSetSharedConnection(false);
+    GalilFakeSetCommandTime(0);
+
+    std::remove(configFile);
+    return ok ? 0 : 1;
+}
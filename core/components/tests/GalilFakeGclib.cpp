@@ -0,0 +1,213 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Simulated Galil controller (DMC-4000), which replaces gclib in the tests. It only
+  implements the gclib functions used by mtsGalilController: commands are accepted
+  (unless an error is set, see GalilFakeGclib.h), queries return zeros and data
+  records are generated at the DR rate, with all motors on and not moving.
+
+  As in gclib, the calls on a connection are serialized: each connection has a lock,
+  held by a command (for the command time, see GalilFakeSetCommandTime) and by GRecord
+  while it returns a record (but not while it waits for the next record). GMessage and
+  GInterrupt do not take the lock.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <time.h>
+
+#include <gclib.h>
+#include <gclibo.h>
+
+#include <cisstCommon/cmnPortability.h>
+
+#include "GalilFakeGclib.h"
+
+namespace {
+
+// Controller sample period (TM), in usec
+const double SAMPLE_PERIOD_US = 1000.0;
+
+// Time (ms) that GMessage, GInterrupt and GRecord (if DR is off) wait before a timeout
+const long READ_TIMEOUT_MS = 20;
+
+// Handles returned by GOpen; they only need to be distinct and non-zero
+const int MAX_CONNECTIONS = 64;
+char Connections[MAX_CONNECTIONS];
+std::mutex ConnectionLocks[MAX_CONNECTIONS];
+std::atomic<int> NumConnections(0);
+
+// See GalilFakeGclib.h
+std::atomic<bool> SharedConnection(false);
+std::atomic<int> SharedHandle(-1);
+std::atomic<long> CommandTimeUs(0);
+std::atomic<int> CommandError(G_NO_ERROR);
+
+// DR period (ms), 0 if off (see GRecordRate)
+std::atomic<double> RecordPeriodMs(0.0);
+
+// Controller sample number of the last DR (16 bits in the DR)
+unsigned int SampleNumber = 0;
+timespec NextRecord = { 0, 0 };
+
+void AddNanoseconds(timespec &t, long ns)
+{
+    t.tv_nsec += ns;
+    while (t.tv_nsec >= 1000000000L) {
+        t.tv_nsec -= 1000000000L;
+        t.tv_sec++;
+    }
+}
+
+void SleepMs(long ms)
+{
+    timespec t = { ms/1000, (ms%1000)*1000000L };
+    nanosleep(&t, 0);
+}
+
+std::mutex &ConnectionLock(GCon g)
+{
+    return ConnectionLocks[static_cast<char *>(g) - Connections];
+}
+
+// Command on connection g, which is held for the command time
+void Command(GCon g)
+{
+    std::lock_guard<std::mutex> lock(ConnectionLock(g));
+    const long us = CommandTimeUs;
+    if (us > 0) {
+        timespec t = { us/1000000L, (us%1000000L)*1000L };
+        nanosleep(&t, 0);
+    }
+}
+
+}
+
+void GalilFakeSetSharedConnection(bool shared)
+{
+    SharedConnection = shared;
+    SharedHandle = -1;
+}
+
+void GalilFakeSetCommandTime(long us)
+{
+    CommandTimeUs = us;
+}
+
+void GalilFakeSetCommandError(int error)
+{
+    CommandError = error;
+}
+
+GReturn GCALL GOpen(GCStringIn CMN_UNUSED(address), GCon *g)
+{
+    if (SharedConnection && (SharedHandle >= 0)) {
+        *g = &Connections[SharedHandle];
+        return G_NO_ERROR;
+    }
+    int n = NumConnections++;
+    if (n >= MAX_CONNECTIONS)
+        return G_OPEN_ERROR;
+    if (SharedConnection)
+        SharedHandle = n;
+    *g = &Connections[n];
+    return G_NO_ERROR;
+}
+
+GReturn GCALL GClose(GCon CMN_UNUSED(g))
+{
+    return G_NO_ERROR;
+}
+
+GReturn GCALL GTimeout(GCon CMN_UNUSED(g), GShort CMN_UNUSED(timeout_ms))
+{
+    return G_NO_ERROR;
+}
+
+GReturn GCALL GCmd(GCon g, GCStringIn CMN_UNUSED(command))
+{
+    Command(g);
+    return CommandError;
+}
+
+GReturn GCALL GCmdT(GCon g, GCStringIn command, GCStringOut trimmed_response,
+                    GSize response_len, GCStringOut *front)
+{
+    Command(g);
+    const char *response = "0,0,0,0,0,0,0,0";
+    if (strcmp(command, "\x12\x16") == 0)
+        response = "DMC4040 Rev 1.3a";
+    else if (strcmp(command, "MG _TM") == 0)
+        response = " 1000.0000";
+    else if (strcmp(command, "WH") == 0)
+        response = "IHB";
+    snprintf(trimmed_response, response_len, "%s", response);
+    if (front) {
+        *front = trimmed_response;
+        while (**front == ' ')
+            (*front)++;
+    }
+    return G_NO_ERROR;
+}
+
+GReturn GCALL GRecordRate(GCon CMN_UNUSED(g), double period_ms)
+{
+    RecordPeriodMs = period_ms;
+    return G_NO_ERROR;
+}
+
+// Called from one thread only (the DR thread of the component)
+GReturn GCALL GRecord(GCon g, union GDataRecord *record, GOption CMN_UNUSED(method))
+{
+    const double periodMs = RecordPeriodMs;
+    if (periodMs <= 0.0) {
+        SleepMs(READ_TIMEOUT_MS);
+        return G_TIMEOUT;
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((NextRecord.tv_sec == 0) || (now.tv_sec > NextRecord.tv_sec + 1))
+        NextRecord = now;    // First record, or the reader was stopped for a while
+    AddNanoseconds(NextRecord, static_cast<long>(periodMs*1.0e6));
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &NextRecord, 0);
+    // The record is available, but is only returned when no command holds the connection
+    std::lock_guard<std::mutex> lock(ConnectionLock(g));
+    SampleNumber += static_cast<unsigned int>(periodMs*1000.0/SAMPLE_PERIOD_US + 0.5);
+    memset(record, 0, sizeof(GDataRecord));
+    record->dmc4000.sample_number = static_cast<uint16_t>(SampleNumber);
+    return G_NO_ERROR;
+}
+
+GReturn GCALL GMessage(GCon CMN_UNUSED(g), GCStringOut buffer, GSize CMN_UNUSED(buffer_len))
+{
+    SleepMs(READ_TIMEOUT_MS);
+    buffer[0] = 0;
+    return G_TIMEOUT;
+}
+
+GReturn GCALL GInterrupt(GCon CMN_UNUSED(g), GStatus *status_byte)
+{
+    SleepMs(READ_TIMEOUT_MS);
+    *status_byte = 0;
+    return G_TIMEOUT;
+}
+
+GReturn GCALL GProgramDownload(GCon CMN_UNUSED(g), GCStringIn CMN_UNUSED(program),
+                               GCStringIn CMN_UNUSED(preprocessor))
+{
+    return G_NO_ERROR;
+}
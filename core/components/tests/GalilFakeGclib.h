@@ -0,0 +1,31 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+  (C) Copyright 2024 Johns Hopkins University (JHU), All Rights Reserved.
+
+  Settings of the simulated controller (see GalilFakeGclib.cpp), used by the tests.
+
+--- begin cisst license - do not edit ---
+
+This software is provided "as is" under an open source license, with
+no warranty.  The complete license can be found in license.txt and
+http://www.cisst.org/cisst/license.txt.
+
+--- end cisst license ---
+*/
+
+#ifndef _GalilFakeGclib_h
+#define _GalilFakeGclib_h
+
+// If true, GOpen returns the same handle for all connections (opened afterwards), as if
+// commands, DR records and messages were read from a single gclib connection
+void GalilFakeSetSharedConnection(bool shared);
+
+// Time (usec) that each command (GCmd, GCmdT) holds its connection
+void GalilFakeSetCommandTime(long us);
+
+// Error returned by GCmd (G_NO_ERROR for none); queries (GCmdT) are not affected
+void GalilFakeSetCommandError(int error);
+
+#endif // _GalilFakeGclib_h